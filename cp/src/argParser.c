@@ -50,19 +50,31 @@ static int opColorProc(int argc, char** argv);
 static int opSetColor(int argc, char** argv);
 static int opCharset(int argc, char** argv);
 static int opRand(int argc, char** argv);
+static int opGamma(int argc, char** argv);
+static int opContrast(int argc, char** argv);
 static int opScalingMode(int argc, char** argv);
 static int opFontRatio(int argc, char** argv);
 static int opSync(int argc, char** argv);
+static int opSyncThreshold(int argc, char** argv);
+static int opAdaptiveSkip(int argc, char** argv);
+static int opDecoderThreads(int argc, char** argv);
+static int opDecoderThreadType(int argc, char** argv);
 static int opVideoFilters(int argc, char** argv);
 static int opScaledVideoFilters(int argc, char** argv);
 static int opAudioFilters(int argc, char** argv);
 static int opPreload(int argc, char** argv);
+static int opProcThreads(int argc, char** argv);
+static int opQueueDepth(int argc, char** argv);
+static int opQueueMem(int argc, char** argv);
+static int opHugePages(int argc, char** argv);
+static int opStats(int argc, char** argv);
 static int opFakeConsole(int argc, char** argv);
 static int opOpenGlSettings(int argc, char** argv);
 static int opExtractorMaxHeight(int argc, char** argv);
 static int opExtractorPrefix(int argc, char** argv);
 static int opExtractorSuffix(int argc, char** argv);
 static int opDisableCLS(int argc, char** argv);
+static int opDeltaDraw(int argc, char** argv);
 static int opDisableAudio(int argc, char** argv);
 static int opDisableKeys(int argc, char** argv);
 static int opLibavLogs(int argc, char** argv);
@@ -86,19 +98,31 @@ static const Option OPTIONS[] = {
 	{"-sc","--set-color",&opSetColor,false},
 	{"-cs","--charset",&opCharset,false},
 	{"-r","--rand",&opRand,false},
+	{"-gm","--gamma",&opGamma,false},
+	{"-ct","--contrast",&opContrast,false},
 	{"-sm","--scaling-mode",&opScalingMode,false},
 	{"-fr","--font-ratio",&opFontRatio,false},
 	{"-sy","--sync",&opSync,false},
+	{"-sth","--sync-threshold",&opSyncThreshold,false},
+	{"-ads","--adaptive-skip",&opAdaptiveSkip,false},
+	{"-dt","--decoder-threads",&opDecoderThreads,false},
+	{"-dtt","--decoder-thread-type",&opDecoderThreadType,false},
 	{"-vf","--video-filters",&opVideoFilters,false},
 	{"-svf","--scaled-video-filters",&opScaledVideoFilters,false},
 	{"-af","--audio-filters",&opAudioFilters,false},
 	{"-pl","--preload",&opPreload,false},
+	{"-pt","--proc-threads",&opProcThreads,false},
+	{"-qd","--queue-depth",&opQueueDepth,false},
+	{"-qm","--queue-mem",&opQueueMem,false},
+	{"-hp","--huge-pages",&opHugePages,false},
+	{"-st","--stats",&opStats,false},
 	{"-fc","--fake-console",&opFakeConsole,false},
 	{"-gls","--opengl-settings",&opOpenGlSettings,false},
 	{"-xmh","--extractor-max-height",&opExtractorMaxHeight,false},
 	{"-xp","--extractor-prefix",&opExtractorPrefix,false},
 	{"-xs","--extractor-suffix",&opExtractorSuffix,false},
 	{"-dcls","--disable-cls",&opDisableCLS,false},
+	{"-dd","--delta-draw",&opDeltaDraw,false},
 	{"-da","--disable-audio",&opDisableAudio,false},
 	{"-dk","--disable-keys",&opDisableKeys,false},
 	{"-avl","--libav-logs",&opLibavLogs,false},
@@ -310,6 +334,20 @@ static void checkSettings(void)
 		error("Single character mode requires colors!", "argParser.c", __LINE__);
 	}
 
+	if (settings.deltaDraw)
+	{
+		if (settings.colorMode == CM_WINAPI_GRAY ||
+			settings.colorMode == CM_WINAPI_16 ||
+			settings.useFakeConsole)
+		{
+			error("Delta drawing works only with \"cstd\" color modes!", "argParser.c", __LINE__);
+		}
+
+		if (settings.setColorMode != SCM_DISABLED) { error("Delta drawing doesn't work with \"set color\" mode!", "argParser.c", __LINE__); }
+		if (settings.disableCLS) { error("Delta drawing requires clearing screen!", "argParser.c", __LINE__); }
+		if (settings.scanlineCount != 1) { error("Delta drawing doesn't work with interlacing!", "argParser.c", __LINE__); }
+	}
+
 	if (settings.colorProcMode == CPM_NONE && settings.brightnessRand)
 	{
 		if (settings.brightnessRand < 0) { settings.brightnessRand = -settings.brightnessRand; }
@@ -537,6 +575,22 @@ static int opRand(int argc, char** argv)
 	return 1;
 }
 
+static int opGamma(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.gamma = atof(argv[0]);
+	if (settings.gamma <= 0.0) { invalidInput("Invalid gamma", argv[0], __LINE__); }
+	return 1;
+}
+
+static int opContrast(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.contrast = atof(argv[0]);
+	if (settings.contrast <= 0.0) { invalidInput("Invalid contrast", argv[0], __LINE__); }
+	return 1;
+}
+
 static int opScalingMode(int argc, char** argv)
 {
 	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
@@ -546,6 +600,8 @@ static int opScalingMode(int argc, char** argv)
 	else if (!strcmp(argv[0], "fast-bilinear")) { settings.scalingMode = SM_FAST_BILINEAR; }
 	else if (!strcmp(argv[0], "bilinear")) { settings.scalingMode = SM_BILINEAR; }
 	else if (!strcmp(argv[0], "bicubic")) { settings.scalingMode = SM_BICUBIC; }
+	else if (!strcmp(argv[0], "area")) { settings.scalingMode = SM_AREA; }
+	else if (!strcmp(argv[0], "auto")) { settings.scalingMode = SM_AUTO; }
 	else { invalidInput("Invalid scaling mode", argv[0], __LINE__); }
 
 	return 1;
@@ -572,6 +628,41 @@ static int opSync(int argc, char** argv)
 	return 1;
 }
 
+static int opSyncThreshold(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.syncThreshold = atoi(argv[0]);
+	if (settings.syncThreshold < 0) { invalidInput("Synchronization threshold cannot be negative", argv[0], __LINE__); }
+	return 1;
+}
+
+static int opAdaptiveSkip(int argc, char** argv)
+{
+	settings.adaptiveSkip = true;
+	return 0;
+}
+
+static int opDecoderThreads(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.decoderThreads = atoi(argv[0]);
+	if (settings.decoderThreads < 0) { invalidInput("Number of decoder threads cannot be negative", argv[0], __LINE__); }
+	return 1;
+}
+
+static int opDecoderThreadType(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+
+	strToLower(argv[0]);
+	if (!strcmp(argv[0], "auto")) { settings.decoderThreadType = DTT_AUTO; }
+	else if (!strcmp(argv[0], "frame")) { settings.decoderThreadType = DTT_FRAME; }
+	else if (!strcmp(argv[0], "slice")) { settings.decoderThreadType = DTT_SLICE; }
+	else { invalidInput("Invalid decoder threading type", argv[0], __LINE__); }
+
+	return 1;
+}
+
 static int opVideoFilters(int argc, char** argv)
 {
 	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
@@ -599,6 +690,46 @@ static int opPreload(int argc, char** argv)
 	return 0;
 }
 
+static int opProcThreads(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.procThreads = atoi(argv[0]);
+	if (settings.procThreads < 0) { invalidInput("Number of processing threads cannot be negative", argv[0], __LINE__); }
+	return 1;
+}
+
+static int opQueueDepth(int argc, char** argv)
+{
+	if (argc < 2 || argv[0][0] == '-' || argv[1][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.queueMinDepth = atoi(argv[0]);
+	settings.queueMaxDepth = atoi(argv[1]);
+	if (settings.queueMinDepth < 2 || settings.queueMaxDepth < settings.queueMinDepth)
+	{
+		invalidInput("Invalid queue depth", NULL, __LINE__);
+	}
+	return 2;
+}
+
+static int opQueueMem(int argc, char** argv)
+{
+	if (argc < 1 || argv[0][0] == '-') { notEnoughArguments(argv, __LINE__); }
+	settings.queueMem = atoi(argv[0]);
+	if (settings.queueMem < 0) { invalidInput("Queue memory budget cannot be negative", argv[0], __LINE__); }
+	return 1;
+}
+
+static int opHugePages(int argc, char** argv)
+{
+	settings.hugePages = true;
+	return 0;
+}
+
+static int opStats(int argc, char** argv)
+{
+	settings.printStats = true;
+	return 0;
+}
+
 static int opFakeConsole(int argc, char** argv)
 {
 	#ifdef CP_DISABLE_OPENGL
@@ -660,6 +791,18 @@ static int opDisableCLS(int argc, char** argv)
 	return 0;
 }
 
+static int opDeltaDraw(int argc, char** argv)
+{
+	settings.deltaDraw = true;
+	if (argc > 0 && argv[0][0] != '-')
+	{
+		settings.deltaRefreshInterval = atoi(argv[0]);
+		if (settings.deltaRefreshInterval < 0) { invalidInput("Full redraw interval cannot be negative", argv[0], __LINE__); }
+		return 1;
+	}
+	return 0;
+}
+
 static int opDisableAudio(int argc, char** argv)
 {
 	settings.disableAudio = true;
@@ -1,14 +1,35 @@
 #include "conplayer.h"
 #include <libavutil/channel_layout.h>
 
+// Audio has its own queue, so slow drawing doesn't stall audio and full audio queue doesn't stall video.
+// Main thread writes at "back", audio thread plays frame at "front".
 typedef struct
 {
 	int front, back;
+	int flushFront;
+	bool flushPending; // audio thread is playing, so it has to move "front" itself
 	uint8_t** audioFrames;
 	int* audioSamplesNum;
 	int* audioFramesSize;
+	int64_t* audioFramesTime; // AV_TIME_BASE units, AV_NOPTS_VALUE if unknown
+	int* audioFramesGeneration; // seek generation, frames from before seek aren't played
+	int64_t nextTime;         // time right after last added frame
+	Mutex mutex;
+	CondVar frameAdded;
+	CondVar framePlayed;
 } AudioQueue;
 
+// Master clock - time of the end of samples handed to libao and when it happened.
+// It's valid only while audio keeps playing, so it can't run ahead after pause, seek or end of audio.
+typedef struct
+{
+	bool valid;
+	int generation;
+	int64_t time;       // AV_TIME_BASE units
+	int64_t updateTime; // ns
+	int64_t maxAdvance; // ns, how long the clock can go on without next frame
+} AudioClock;
+
 #ifdef _WIN32
 
 static const enum AVSampleFormat SAMPLE_FORMAT_AV = AV_SAMPLE_FMT_S32;
@@ -31,12 +52,15 @@ static bool initialized = false;
 static SwrContext* resampleContext = NULL;
 
 static const int AUDIO_QUEUE_SIZE = 128;
-static volatile AudioQueue audioQueue;
+static const int64_t CLOCK_TOLERANCE = 50000000; // ns
+static AudioQueue audioQueue;
+static AudioClock audioClock;
 
 static ao_sample_format aoSampleFormat;
 static ao_device* aoDevice = NULL;
 
 static bool initAudioLib(void);
+static int nextAudioIndex(int index);
 
 void initAudio(Stream* avAudioStream)
 {
@@ -60,104 +84,168 @@ void initAudio(Stream* avAudioStream)
 
 	audioQueue.front = 0;
 	audioQueue.back = 0;
+	audioQueue.flushPending = false;
+	audioQueue.nextTime = AV_NOPTS_VALUE;
+	audioClock.valid = false;
+	initMutex(&audioQueue.mutex);
+	initCondVar(&audioQueue.frameAdded);
+	initCondVar(&audioQueue.framePlayed);
 	audioQueue.audioFrames = (uint8_t**)calloc(AUDIO_QUEUE_SIZE, sizeof(uint8_t*));
 	audioQueue.audioSamplesNum = (int*)malloc(AUDIO_QUEUE_SIZE * sizeof(int));
 	audioQueue.audioFramesSize = (int*)calloc(AUDIO_QUEUE_SIZE, sizeof(int));
+	audioQueue.audioFramesTime = (int64_t*)malloc(AUDIO_QUEUE_SIZE * sizeof(int64_t));
+	audioQueue.audioFramesGeneration = (int*)malloc(AUDIO_QUEUE_SIZE * sizeof(int));
 
 	initialized = true;
 }
 
-void addAudioFrame(AVFrame* frame)
+void addAudioFrame(AVFrame* frame, int64_t time, int generation)
 {
-	if (!initialized) { return; }
+	// audio is played only with synchronized video
+	if (!initialized || settings.syncMode == SYNC_DISABLED) { return; }
 
-	Frame* queueFrame = dequeueFrame(STAGE_FREE, NULL);
-	
+	// audio thread skips frames from before seek, so it frees space quickly after seek
+	lockMutex(&audioQueue.mutex);
+	while (nextAudioIndex(audioQueue.back) == audioQueue.front)
+	{
+		waitCondVar(&audioQueue.framePlayed, &audioQueue.mutex);
+	}
+	int back = audioQueue.back;
+	unlockMutex(&audioQueue.mutex);
+
+	// audio thread doesn't touch frame at "back" until it is added
 	int outSamples = swr_get_out_samples(resampleContext, frame->nb_samples);
-	if (queueFrame->audioFrameSize < outSamples)
+	if (audioQueue.audioFramesSize[back] < outSamples)
 	{
-		queueFrame->audioFrameSize = outSamples * 2; // just for prevention
-		if (queueFrame->audioFrame) { av_free(queueFrame->audioFrame); }
-		av_samples_alloc(&queueFrame->audioFrame, NULL, CHANNELS,
-			queueFrame->audioFrameSize, SAMPLE_FORMAT_AV, 0);
+		audioQueue.audioFramesSize[back] = outSamples * 2; // just for prevention
+		if (audioQueue.audioFrames[back]) { av_free(audioQueue.audioFrames[back]); }
+		av_samples_alloc(&audioQueue.audioFrames[back], NULL, CHANNELS,
+			audioQueue.audioFramesSize[back], SAMPLE_FORMAT_AV, 0);
 	}
 
-	outSamples = swr_convert(resampleContext, &queueFrame->audioFrame, outSamples,
+	outSamples = swr_convert(resampleContext, &audioQueue.audioFrames[back], outSamples,
 		(const uint8_t**)frame->extended_data, frame->nb_samples);
 	if (outSamples < 0) { return; }
 
-	queueFrame->audioSamplesNum = outSamples;
-	queueFrame->isAudio = true;
+	lockMutex(&audioQueue.mutex);
+
+	// frames without time (like ones from audio filters) continue after the previous one
+	if (time == AV_NOPTS_VALUE) { time = audioQueue.nextTime; }
+	audioQueue.audioFramesTime[back] = time;
+	audioQueue.audioFramesGeneration[back] = generation;
+	audioQueue.nextTime = time == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+		time + (((int64_t)outSamples * AV_TIME_BASE) / SAMPLE_RATE);
+
+	audioQueue.audioSamplesNum[back] = outSamples;
+	audioQueue.back = nextAudioIndex(back);
+	wakeCondVar(&audioQueue.frameAdded);
+	unlockMutex(&audioQueue.mutex);
+}
+
+void clearAudio(void)
+{
+	if (!initialized) { return; }
 
-	enqueueFrame(STAGE_LOADED_FRAME);
+	lockMutex(&audioQueue.mutex);
+	audioQueue.flushFront = audioQueue.back;
+	audioQueue.flushPending = true;
+	audioQueue.nextTime = AV_NOPTS_VALUE;
+	audioClock.valid = false;
+	unlockMutex(&audioQueue.mutex);
+}
+
+bool getAudioClock(int64_t* time)
+{
+	if (!initialized) { return false; }
+
+	lockMutex(&audioQueue.mutex);
+	int64_t advance = getTimeNs() - audioClock.updateTime;
+	bool valid = audioClock.valid && advance <= audioClock.maxAdvance &&
+		audioClock.generation == psnip_atomic_int32_load(&seekGeneration);
+	if (valid) { *time = audioClock.time + (advance / (1000000000 / AV_TIME_BASE)); }
+	unlockMutex(&audioQueue.mutex);
+
+	return valid;
 }
 
 void audioLoop(void)
 {
-	const int TIME_TO_SLEEP = 8;
 	if (!initialized) { return; }
 
 	while (true)
 	{
-		if (audioQueue.front != audioQueue.back)
+		waitWhilePaused();
+
+		lockMutex(&audioQueue.mutex);
+		if (audioQueue.flushPending)
 		{
-			#ifdef _WIN32
-
-			int* fullSamples = (int*)audioQueue.audioFrames[audioQueue.front];
-			for (int i = 0; i < audioQueue.audioSamplesNum[audioQueue.front]; i++)
-			{
-				fullSamples[i * 2] = (int)((double)fullSamples[i * 2] * settings.volume);
-				fullSamples[i * 2 + 1] = (int)((double)fullSamples[i * 2 + 1] * settings.volume);
-			}
-
-			#else
-
-			short* fullSamples = (short*)audioQueue.audioFrames[audioQueue.front];
-			for (int i = 0; i < audioQueue.audioSamplesNum[audioQueue.front]; i++)
-			{
-				fullSamples[i * 2] = (short)((double)fullSamples[i * 2] * settings.volume);
-				fullSamples[i * 2 + 1] = (short)((double)fullSamples[i * 2 + 1] * settings.volume);
-			}
-
-			#endif
-
-			ao_play(aoDevice, audioQueue.audioFrames[audioQueue.front],
-				audioQueue.audioSamplesNum[audioQueue.front] * SAMPLE_SIZE);
-			
-			audioQueue.front++;
-			if (audioQueue.front == AUDIO_QUEUE_SIZE) { audioQueue.front = 0; }
+			audioQueue.front = audioQueue.flushFront;
+			audioQueue.flushPending = false;
+			wakeCondVar(&audioQueue.framePlayed);
 		}
+		while (audioQueue.front == audioQueue.back)
+		{
+			waitCondVar(&audioQueue.frameAdded, &audioQueue.mutex);
+		}
+		int front = audioQueue.front;
+		bool stale = audioQueue.audioFramesGeneration[front] != psnip_atomic_int32_load(&seekGeneration);
+		unlockMutex(&audioQueue.mutex);
 
-		Sleep(TIME_TO_SLEEP);
-	}
-}
+		if (stale)
+		{
+			lockMutex(&audioQueue.mutex);
+			if (!audioQueue.flushPending) { audioQueue.front = nextAudioIndex(front); }
+			wakeCondVar(&audioQueue.framePlayed);
+			unlockMutex(&audioQueue.mutex);
+			continue;
+		}
 
-void playAudio(Frame* frame)
-{
-	while ((audioQueue.back + 1 == audioQueue.front) ||
-		(audioQueue.back == AUDIO_QUEUE_SIZE - 1 && audioQueue.front == 0))
-	{
-		Sleep(0);
-	}
+		#ifdef _WIN32
 
-	if (audioQueue.audioFramesSize[audioQueue.back] < frame->audioFrameSize)
-	{
-		if (audioQueue.audioFrames[audioQueue.back])
+		int* fullSamples = (int*)audioQueue.audioFrames[front];
+		for (int i = 0; i < audioQueue.audioSamplesNum[front]; i++)
 		{
-			av_free(audioQueue.audioFrames[audioQueue.back]);
+			fullSamples[i * 2] = (int)((double)fullSamples[i * 2] * settings.volume);
+			fullSamples[i * 2 + 1] = (int)((double)fullSamples[i * 2 + 1] * settings.volume);
 		}
-		av_samples_alloc(&audioQueue.audioFrames[audioQueue.back], NULL,
-			CHANNELS, frame->audioFrameSize, SAMPLE_FORMAT_AV, 0);
-		audioQueue.audioFramesSize[audioQueue.back] = frame->audioFrameSize;
-	}
 
-	audioQueue.audioSamplesNum[audioQueue.back] = frame->audioSamplesNum;
-	av_samples_copy(&audioQueue.audioFrames[audioQueue.back],
-		&frame->audioFrame, 0, 0, frame->audioSamplesNum,
-		CHANNELS, SAMPLE_FORMAT_AV);
+		#else
+
+		short* fullSamples = (short*)audioQueue.audioFrames[front];
+		for (int i = 0; i < audioQueue.audioSamplesNum[front]; i++)
+		{
+			fullSamples[i * 2] = (short)((double)fullSamples[i * 2] * settings.volume);
+			fullSamples[i * 2 + 1] = (short)((double)fullSamples[i * 2 + 1] * settings.volume);
+		}
 
-	audioQueue.back++;
-	if (audioQueue.back == AUDIO_QUEUE_SIZE) { audioQueue.back = 0; }
+		#endif
+
+		ao_play(aoDevice, audioQueue.audioFrames[front],
+			audioQueue.audioSamplesNum[front] * SAMPLE_SIZE);
+
+		lockMutex(&audioQueue.mutex);
+		if (audioQueue.flushPending)
+		{
+			// frame from before seek was played, clock stays invalid
+			audioQueue.front = audioQueue.flushFront;
+			audioQueue.flushPending = false;
+		}
+		else
+		{
+			// ao_play() returns when samples are handed to the device, clock is set to their end
+			int64_t duration = ((int64_t)audioQueue.audioSamplesNum[front] * 1000000000) / SAMPLE_RATE;
+			audioClock.valid = audioQueue.audioFramesTime[front] != AV_NOPTS_VALUE;
+			audioClock.generation = audioQueue.audioFramesGeneration[front];
+			audioClock.time = audioQueue.audioFramesTime[front] +
+				(((int64_t)audioQueue.audioSamplesNum[front] * AV_TIME_BASE) / SAMPLE_RATE);
+			audioClock.updateTime = getTimeNs();
+			audioClock.maxAdvance = (duration * 2) + CLOCK_TOLERANCE;
+
+			audioQueue.front = nextAudioIndex(front);
+		}
+		wakeCondVar(&audioQueue.framePlayed);
+		unlockMutex(&audioQueue.mutex);
+	}
 }
 
 static bool initAudioLib(void)
@@ -192,4 +280,10 @@ static bool initAudioLib(void)
 	#endif
 
 	return aoDevice != NULL;
+}
+
+static int nextAudioIndex(int index)
+{
+	index++;
+	return index == AUDIO_QUEUE_SIZE ? 0 : index;
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "conplayer.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Every buffer starts with a header placed one cache line before the returned pointer.
+// Free buffers are kept in lists by size bucket, so seeks and console resizes reuse memory
+// instead of going back to the allocator.
+typedef struct PoolBuffer
+{
+	struct PoolBuffer* next;
+	size_t size;       // usable size (size of bucket)
+	size_t mappedSize; // 0 when allocated from heap
+	int bucket;
+} PoolBuffer;
+
+typedef union
+{
+	PoolBuffer buffer;
+	uint8_t padding[CP_CACHE_LINE_SIZE];
+} PoolBufferHeader;
+
+static const size_t MIN_BUCKET_SIZE = 4096;
+static const int MIN_BUCKET_SHIFT = 12;
+static const int SUBBUCKETS = 4; // per power of two, so rounding wastes at most 25%
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+static const size_t DEFAULT_MAX_IDLE_SIZE = 64 * 1024 * 1024;
+#define BUCKET_COUNT 128
+
+static PoolBuffer* freeLists[BUCKET_COUNT] = { NULL };
+static size_t idleSize = 0;
+static Mutex poolMutex;
+
+static int getBucket(size_t size, size_t* bucketSize);
+static PoolBuffer* allocBuffer(size_t size);
+static void freeBuffer(PoolBuffer* buffer);
+static void* allocHugePages(size_t size, size_t* mappedSize);
+
+void initBufferPool(void)
+{
+	initMutex(&poolMutex);
+}
+
+void* poolAlloc(size_t size)
+{
+	size_t bucketSize;
+	int bucket = getBucket(size, &bucketSize);
+
+	lockMutex(&poolMutex);
+	PoolBuffer* buffer = freeLists[bucket];
+	if (buffer)
+	{
+		freeLists[bucket] = buffer->next;
+		idleSize -= buffer->size;
+		stats.poolReused++;
+	}
+	unlockMutex(&poolMutex);
+
+	if (!buffer)
+	{
+		buffer = allocBuffer(bucketSize);
+		buffer->bucket = bucket;
+	}
+
+	return (uint8_t*)buffer + sizeof(PoolBufferHeader);
+}
+
+void poolFree(void* ptr)
+{
+	if (!ptr) { return; }
+	PoolBuffer* buffer = (PoolBuffer*)((uint8_t*)ptr - sizeof(PoolBufferHeader));
+
+	// don't keep too much memory when queue shrinks or console gets smaller
+	size_t maxIdleSize = settings.queueMem ? (size_t)settings.queueMem * 1024 * 1024 : DEFAULT_MAX_IDLE_SIZE;
+
+	lockMutex(&poolMutex);
+	if (idleSize + buffer->size <= maxIdleSize)
+	{
+		buffer->next = freeLists[buffer->bucket];
+		freeLists[buffer->bucket] = buffer;
+		idleSize += buffer->size;
+		buffer = NULL;
+	}
+	unlockMutex(&poolMutex);
+
+	if (buffer) { freeBuffer(buffer); }
+}
+
+void* poolResize(void* ptr, size_t size)
+{
+	// content isn't preserved, buffer is reused if it isn't too big for the new size
+	size_t curSize = poolBufferSize(ptr);
+	if (curSize >= size && curSize / 2 < size) { return ptr; }
+
+	poolFree(ptr);
+	return poolAlloc(size);
+}
+
+size_t poolBufferSize(void* ptr)
+{
+	if (!ptr) { return 0; }
+	return ((PoolBuffer*)((uint8_t*)ptr - sizeof(PoolBufferHeader)))->size;
+}
+
+static int getBucket(size_t size, size_t* bucketSize)
+{
+	if (size <= MIN_BUCKET_SIZE)
+	{
+		*bucketSize = MIN_BUCKET_SIZE;
+		return 0;
+	}
+
+	// size is in (powerOf2, 2 * powerOf2]
+	int shift = MIN_BUCKET_SHIFT;
+	while (((size_t)1 << (shift + 1)) < size) { shift++; }
+
+	size_t powerOf2 = (size_t)1 << shift;
+	size_t step = powerOf2 / SUBBUCKETS;
+	size_t subbucket = (size - powerOf2 + step - 1) / step;
+
+	int bucket = ((shift - MIN_BUCKET_SHIFT) * SUBBUCKETS) + (int)subbucket;
+	if (bucket >= BUCKET_COUNT) { error("Buffer is too big!", "bufferPool.c", __LINE__); }
+
+	*bucketSize = powerOf2 + (subbucket * step);
+	return bucket;
+}
+
+static PoolBuffer* allocBuffer(size_t size)
+{
+	size_t fullSize = size + sizeof(PoolBufferHeader);
+	size_t mappedSize = 0;
+	PoolBuffer* buffer = NULL;
+
+	if (settings.hugePages && fullSize >= HUGE_PAGE_SIZE)
+	{
+		buffer = (PoolBuffer*)allocHugePages(fullSize, &mappedSize);
+	}
+
+	if (!buffer)
+	{
+		#ifdef _WIN32
+		buffer = (PoolBuffer*)_aligned_malloc(fullSize, CP_CACHE_LINE_SIZE);
+		#else
+		if (posix_memalign((void**)&buffer, CP_CACHE_LINE_SIZE, fullSize)) { buffer = NULL; }
+		#endif
+	}
+
+	if (!buffer) { error("Failed to allocate buffer!", "bufferPool.c", __LINE__); }
+
+	buffer->next = NULL;
+	buffer->size = size;
+	buffer->mappedSize = mappedSize;
+
+	lockMutex(&poolMutex);
+	stats.poolAllocated += mappedSize ? mappedSize : fullSize;
+	if (mappedSize) { stats.poolHugePageBuffers++; }
+	unlockMutex(&poolMutex);
+
+	return buffer;
+}
+
+static void freeBuffer(PoolBuffer* buffer)
+{
+	size_t mappedSize = buffer->mappedSize;
+	size_t fullSize = buffer->size + sizeof(PoolBufferHeader);
+
+	lockMutex(&poolMutex);
+	stats.poolAllocated -= mappedSize ? mappedSize : fullSize;
+	if (mappedSize) { stats.poolHugePageBuffers--; }
+	unlockMutex(&poolMutex);
+
+	#ifdef _WIN32
+	if (mappedSize) { VirtualFree(buffer, 0, MEM_RELEASE); }
+	else { _aligned_free(buffer); }
+	#else
+	if (mappedSize) { munmap(buffer, mappedSize); }
+	else { free(buffer); }
+	#endif
+}
+
+static void* allocHugePages(size_t size, size_t* mappedSize)
+{
+	#ifdef _WIN32
+
+	// requires "Lock pages in memory" privilege, without it allocation just fails
+	size_t largePageSize = GetLargePageMinimum();
+	if (!largePageSize) { return NULL; }
+
+	size = ((size + largePageSize - 1) / largePageSize) * largePageSize;
+	void* ptr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (!ptr) { return NULL; }
+
+	*mappedSize = size;
+	return ptr;
+
+	#else
+
+	size = ((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+	void* ptr = MAP_FAILED;
+
+	#ifdef MAP_HUGETLB
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	#endif
+
+	// no reserved huge pages, transparent huge pages can still be used,
+	// but only for 2 MiB aligned ranges - extra page is mapped and trimmed around the aligned part
+	if (ptr == MAP_FAILED)
+	{
+		uint8_t* area = (uint8_t*)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area == (uint8_t*)MAP_FAILED) { return NULL; }
+
+		size_t head = (HUGE_PAGE_SIZE - ((uintptr_t)area % HUGE_PAGE_SIZE)) % HUGE_PAGE_SIZE;
+		if (head) { munmap(area, head); }
+		munmap(area + head + size, HUGE_PAGE_SIZE - head);
+		ptr = area + head;
+
+		#ifdef MADV_HUGEPAGE
+		madvise(ptr, size, MADV_HUGEPAGE);
+		#endif
+	}
+
+	*mappedSize = size;
+	return ptr;
+
+	#endif
+}
\ No newline at end of file
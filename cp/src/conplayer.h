@@ -24,8 +24,10 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <float.h>
+#include <limits.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavfilter/avfilter.h>
@@ -95,6 +97,31 @@
 #define CP_CPU "[unknown]"
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define CP_ATOMIC_LOAD_ACQUIRE(object) __atomic_load_n(object, __ATOMIC_ACQUIRE)
+#define CP_ATOMIC_STORE_RELEASE(object, desired) __atomic_store_n(object, desired, __ATOMIC_RELEASE)
+#define CP_ATOMIC_LOAD_ACQUIRE64(object) __atomic_load_n(object, __ATOMIC_ACQUIRE)
+#define CP_ATOMIC_STORE_RELEASE64(object, desired) __atomic_store_n(object, desired, __ATOMIC_RELEASE)
+#define CP_ATOMIC_FETCH_ADD64(object, operand) __atomic_fetch_add(object, operand, __ATOMIC_ACQ_REL)
+#define CP_ATOMIC_EXCHANGE(object, desired) __atomic_exchange_n(object, desired, __ATOMIC_ACQ_REL)
+#elif defined(_MSC_VER)
+#define CP_ATOMIC_LOAD_ACQUIRE(object) InterlockedOr(object, 0)
+#define CP_ATOMIC_STORE_RELEASE(object, desired) InterlockedExchange(object, desired)
+#define CP_ATOMIC_LOAD_ACQUIRE64(object) InterlockedOr64(object, 0)
+#define CP_ATOMIC_STORE_RELEASE64(object, desired) InterlockedExchange64(object, desired)
+#define CP_ATOMIC_FETCH_ADD64(object, operand) InterlockedExchangeAdd64(object, operand)
+#define CP_ATOMIC_EXCHANGE(object, desired) InterlockedExchange(object, desired)
+#else
+#define CP_ATOMIC_LOAD_ACQUIRE(object) psnip_atomic_int32_load(object)
+#define CP_ATOMIC_STORE_RELEASE(object, desired) psnip_atomic_int32_store(object, desired)
+#define CP_ATOMIC_LOAD_ACQUIRE64(object) psnip_atomic_int64_load(object)
+#define CP_ATOMIC_STORE_RELEASE64(object, desired) psnip_atomic_int64_store(object, desired)
+#define CP_ATOMIC_FETCH_ADD64(object, operand) psnip_atomic_int64_add(object, operand)
+#define CP_ATOMIC_EXCHANGE(object, desired) atomicExchange(object, desired)
+#endif
+
+#define CP_CACHE_LINE_SIZE 64
+
 #define CP_VERSION "1.5.1"
 #define CP_VERSION_STRING "ConPlayer " CP_VERSION " [" CP_CPU "/" CP_OS "]"
 
@@ -106,6 +133,8 @@
 typedef uintptr_t ThreadIDType;
 typedef void ThreadRetType;
 typedef _beginthread_proc_type ThreadFuncPtr;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE CondVar;
 
 #else
 
@@ -115,6 +144,8 @@ typedef _beginthread_proc_type ThreadFuncPtr;
 typedef pthread_t ThreadIDType;
 typedef void* ThreadRetType;
 typedef void* (*ThreadFuncPtr)(void*);
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
 
 typedef void* HWND;
 typedef void* HANDLE;
@@ -135,6 +166,8 @@ typedef unsigned long DWORD;
 
 #endif
 
+typedef void (*BandFuncPtr)(void* args, int band);
+
 typedef enum
 {
 	CM_WINAPI_GRAY,
@@ -158,7 +191,9 @@ typedef enum
 	SM_NEAREST,
 	SM_FAST_BILINEAR,
 	SM_BILINEAR,
-	SM_BICUBIC
+	SM_BICUBIC,
+	SM_AREA,
+	SM_AUTO
 } ScalingMode;
 
 typedef enum
@@ -175,6 +210,13 @@ typedef enum
 	SYNC_ENABLED
 } SyncMode;
 
+typedef enum
+{
+	DTT_AUTO,
+	DTT_FRAME,
+	DTT_SLICE
+} DecoderThreadType;
+
 typedef enum
 {
 	STAGE_FREE,
@@ -182,10 +224,18 @@ typedef enum
 	STAGE_PROCESSED_FRAME
 } Stage;
 
+// character of C std output as it's displayed, used by delta drawing (-dd)
+typedef struct
+{
+	char ch;
+	uint8_t r, g, b; // 16 and 256 color modes - palette index in "r", gray mode - not used
+} Cell;
+
 typedef struct
 {
-	Stage stage;
-	bool isAudio;
+	psnip_atomic_int32 stage; // Stage, published with release and read with acquire
+	int generation;           // seek generation frame was loaded in
+	bool late;                // skipped by processing thread, because it was already too late
 	int64_t time;
 
 	// video
@@ -198,13 +248,66 @@ typedef struct
 	// video - STAGE_PROCESSED_FRAME
 	void* output; // char* (C std) / CHAR_INFO* (WinAPI) / GLConsoleChar* (-fc)
 	int* outputLineOffsets;
-
-	// audio
-	uint8_t* audioFrame;
-	int audioFrameSize;
-	int audioSamplesNum;
+	Cell* cells; // only with delta drawing
+	uint8_t* rowColors; // processed colors of one row for every band (see procColors())
 } Frame;
 
+typedef struct
+{
+	// queue.c
+	int queueDepth;
+	int queueMinDepthSeen;
+	int queueMaxDepthSeen;
+	int queueAllocatedSlots;
+	size_t queueSlotSize;
+	int64_t queueOccupancySum;
+	int64_t queueOccupancySamples;
+	int queueMaxOccupancy;
+	int queueUnderruns;
+
+	// decodeFrame.c
+	int decodeSkipLevel;
+	int decodeSkipMaxLevel;
+	int decodeSkipChanges;
+	int64_t decodeSkipPackets; // video packets decoded with some skipping
+	int64_t decodePackets;
+	int decoderThreads;    // thread count and type used by libavcodec
+	int decoderThreadType; // FF_THREAD_FRAME / FF_THREAD_SLICE
+	int64_t decodedFrames;
+	int64_t decodeTime; // ns spent in avcodec_send_packet() and avcodec_receive_frame() of video
+	int64_t firstDecodedTime, lastDecodedTime; // getTimeNs() when first and last video frame was received
+	int64_t directScaledFrames; // frames scaled straight from decoded planes (scaling.c)
+	int64_t swsScaledFrames;  // frames scaled into queue slot with swscale
+	int64_t scaleTime;        // ns spent scaling frames into queue slots
+
+	// scaling.c
+	int swsContextsCreated;
+	int swsCacheHits;
+
+	// bufferPool.c
+	size_t poolAllocated;
+	int64_t poolReused;
+	int poolHugePageBuffers;
+
+	// threads.c
+	int seekCount;
+	double seekLatencySum, seekLatencyMax, seekLatencyLast;
+	int64_t seekDroppedFrames;
+	int64_t pacingFrames;     // frames drawn after sleeping to their deadline
+	int64_t pacingLateFrames; // frames that missed their deadline before sleeping
+	double pacingJitterSum, pacingJitterSqSum, pacingJitterMax; // wake-up delay in seconds
+	int64_t syncFrames;        // frames presented against audio clock
+	int64_t syncDroppedFrames; // frames later than sync threshold, dropped by draw thread
+	psnip_atomic_int64 lateDroppedFrames; // frames later than sync threshold, not processed at all
+	int64_t consoleSkippedFrames; // frames replaced by newer ones before console thread displayed them
+
+	// drawFrame.c
+	int64_t drawnFrames;  // C std frames written to stdout
+	int64_t fullRedraws;  // frames written whole with delta drawing
+	int64_t drawnBytes;
+	double syncDriftSum, syncDriftMax; // video time - audio time in seconds, max is absolute
+} Stats;
+
 typedef struct
 {
 	int index;
@@ -214,6 +317,22 @@ typedef struct
 	AVCodecContext* codecContext;
 } Stream;
 
+typedef struct
+{
+	AVPacket* packet;
+	int generation;
+	bool end; // end of input, packet is empty
+} QueuedPacket;
+
+typedef struct
+{
+	QueuedPacket* packets;
+	int size, front, count;
+	Mutex mutex;
+	CondVar packetAdded;
+	CondVar packetRemoved;
+} PacketQueue;
+
 typedef struct
 {
 	int argW, argH;
@@ -227,9 +346,14 @@ typedef struct
 	int setColorVal1, setColorVal2;
 	double constFontRatio;
 	int brightnessRand;
+	double gamma, contrast;
 	ScalingMode scalingMode;
 	ColorProcMode colorProcMode;
 	SyncMode syncMode;
+	int syncThreshold; // ms
+	bool adaptiveSkip;
+	int decoderThreads;
+	DecoderThreadType decoderThreadType;
 	char* videoFilters;
 	char* scaledVideoFilters;
 	char* audioFilters;
@@ -237,13 +361,19 @@ typedef struct
 	bool useFakeConsole;
 	bool disableKeyboard;
 	bool disableCLS;
+	bool deltaDraw;
+	int deltaRefreshInterval; // frames between full redraws, 0 - only after resizing
 	bool disableAudio;
 	bool libavLogs;
+	int procThreads;
+	int queueMinDepth, queueMaxDepth;
+	int queueMem; // MB, 0 - no limit
+	bool hugePages;
+	bool printStats;
 } Settings;
 
 
 //main.c
-extern const int QUEUE_SIZE;
 extern HWND conHWND, wtDragBarHWND;
 extern int conW, conH;
 extern int vidW, vidH;
@@ -265,13 +395,6 @@ extern char* secondInputFile;
 //drawFrame.c
 extern HANDLE outputHandle;
 
-//thread.c
-extern const int SLEEP_ON_FREEZE;
-extern volatile bool freezeThreads;
-extern volatile bool mainFreezed;
-extern volatile bool procFreezed;
-extern volatile bool drawFreezed;
-
 //help.c
 extern const char* INFO_MESSAGE;
 
@@ -282,21 +405,48 @@ extern void argumentParser(int argc, char** argv);
 //decodeFrame.c
 extern void initDecodeFrame(const char* file, const char* secondFile, Stream** outAudioStream);
 extern void readFrames(void);
+extern psnip_atomic_int32 seekGeneration;
 extern void avSeek(int64_t timestamp);
+extern void setDecoderThreading(AVCodecContext* codecContext);
+
+//packetQueue.c
+extern void initPacketQueue(PacketQueue* queue, int size);
+extern bool putPacket(PacketQueue* queue, AVPacket* packet, int generation);
+extern bool getPacket(PacketQueue* queue, AVPacket* packet, int* generation);
+extern void flushPacketQueue(PacketQueue* queue);
+extern void wakePacketQueue(PacketQueue* queue);
+
+//scaling.c
+extern bool canScaleLuma(const AVFrame* frame, int dstW, int dstH);
+extern bool canScaleYuv(const AVFrame* frame, int dstW, int dstH);
+extern void scaleLuma(const AVFrame* frame, uint8_t* dst, int dstLinesize, int dstW, int dstH);
+extern void scaleYuvToRgb(const AVFrame* frame, uint8_t* dst, int dstLinesize, int dstW, int dstH);
+extern struct SwsContext* getSwsContext(int srcW, int srcH, enum AVPixelFormat srcFormat,
+	int dstW, int dstH, enum AVPixelFormat dstFormat, int flags, uint8_t** buffer);
+extern void releaseSwsContext(struct SwsContext* context);
 
 //processFrame.c
-extern void processFrame(Frame* frame);
+extern void initProcessFrame(void);
+extern void processFrame(Frame* frame, uint32_t* randState);
+extern int writeCellColor(char* output, const Cell* cell);
+
+//simd.c
+extern void initSimd(void);
+extern const char* getSimdName(void);
+extern void translateBytes(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table);
+extern void procColors(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b, uint8_t* luma, int count, bool saturate);
 
 //drawFrame.c
 extern void initDrawFrame(void);
 extern void refreshSize(void);
-extern void drawFrame(void* output, int* lineOffsets, int fw, int fh);
+extern void drawFrame(void* output, int* lineOffsets, Cell* cells, int fw, int fh);
 
 //audio.c
 extern void initAudio(Stream* audioStream);
-extern void addAudioFrame(AVFrame* frame);
+extern void addAudioFrame(AVFrame* frame, int64_t time, int generation);
+extern void clearAudio(void);
+extern bool getAudioClock(int64_t* time);
 extern void audioLoop(void);
-extern void playAudio(Frame* frame);
 
 //avFilters.c
 extern void initFiltersV(Stream* videoStream);
@@ -311,11 +461,28 @@ extern bool getFilteredFrameA(AVFrame* filterFrame);
 
 //threads.c
 extern void beginThreads(void);
+extern void waitWhilePaused(void);
+extern void runBands(BandFuncPtr bandFunc, void* args, int bandCount);
+extern bool isFrameLate(Frame* frame);
 
 //queue.c
 extern void initQueue(void);
-extern Frame* dequeueFrame(Stage fromStage, volatile bool* threadFreezedFlag);
-extern void enqueueFrame(Stage toStage);
+extern Frame* dequeueFrame(Stage fromStage);
+extern void enqueueFrame(Frame* frame, Stage toStage);
+extern void setDecodeEnd(bool value, int generation);
+extern int getQueueFill(void);
+
+//bufferPool.c
+extern void initBufferPool(void);
+extern void* poolAlloc(size_t size);
+extern void poolFree(void* ptr);
+extern void* poolResize(void* ptr, size_t size);
+extern size_t poolBufferSize(void* ptr);
+
+//stats.c
+extern Stats stats;
+extern void printStats(void);
+extern const char* getDecoderThreadTypeName(int activeThreadType);
 
 //help.c
 extern void showHelp(bool basic, bool advanced, bool modes, bool keyboard);
@@ -327,8 +494,20 @@ extern void showVersion(void);
 extern int cp_min(int a, int b);
 extern int cp_max(int a, int b);
 extern int cp_clamp(int val, int min, int max);
+extern uint32_t cpRand(uint32_t* state);
+extern int getCpuCount(void);
+extern int32_t atomicExchange(psnip_atomic_int32* object, int32_t desired);
 extern double getTime(void);
+extern int64_t getTimeNs(void);
+extern void sleepUntilNs(int64_t deadline);
 extern ThreadIDType startThread(ThreadFuncPtr threadFunc, void* args);
+extern void initMutex(Mutex* mutex);
+extern void lockMutex(Mutex* mutex);
+extern void unlockMutex(Mutex* mutex);
+extern void initCondVar(CondVar* condVar);
+extern void waitCondVar(CondVar* condVar, Mutex* mutex);
+extern bool waitCondVarTimeout(CondVar* condVar, Mutex* mutex, DWORD ms);
+extern void wakeCondVar(CondVar* condVar);
 extern void strToLower(char* str);
 extern void getConsoleWindow(void);
 extern void clearScreen(void);
@@ -1,6 +1,38 @@
 #include "conplayer.h"
 
 static const double CONSOLE_REFRESH_PERIOD = 0.2;
+static const int VIDEO_PACKET_QUEUE_SIZE = 256;
+static const int AUDIO_PACKET_QUEUE_SIZE = 512;
+static const int WINDOW_LOOP_PERIOD = 16; // ms
+
+// every input is read by its own thread, so stalled read of one doesn't block the other
+typedef struct
+{
+	AVFormatContext* context;
+	bool primary;   // reads formatContext, handles end of input without video
+	int generation; // seek generation of packets being read
+} Demuxer;
+
+// Adaptive decoder skipping - every window of video packets is checked for how often pipeline was
+// behind, then skip level is raised, or lowered after few calm windows. Levels are in order of
+// visibility of artifacts: loop filter, IDCT and whole frames.
+typedef struct
+{
+	enum AVDiscard skipLoopFilter, skipIdct, skipFrame;
+} DecodeSkipLevel;
+
+static const DecodeSkipLevel DECODE_SKIP_LEVELS[] = {
+	{ AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT },
+	{ AVDISCARD_NONREF, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT },
+	{ AVDISCARD_ALL, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT },
+	{ AVDISCARD_ALL, AVDISCARD_NONREF, AVDISCARD_DEFAULT },
+	{ AVDISCARD_ALL, AVDISCARD_NONREF, AVDISCARD_NONREF },
+	{ AVDISCARD_ALL, AVDISCARD_NONREF, AVDISCARD_NONKEY } };
+
+static const int DECODE_SKIP_LEVEL_COUNT = sizeof(DECODE_SKIP_LEVELS) / sizeof(DecodeSkipLevel);
+static const int DECODE_SKIP_WINDOW = 16;       // video packets
+static const int DECODE_SKIP_CALM_WINDOWS = 4;  // windows without problems before level is lowered
+static const int DECODE_SKIP_WARMUP_WINDOWS = 2; // queue is still filling after start and seek
 
 static Stream videoStream = { -1 };
 static Stream audioStream = { -1 };
@@ -16,22 +48,53 @@ static AVFrame* decodedFrame;
 static AVFrame* rgbFrame;       // for video with first stage shaders enabled
 static AVFrame* filterFrame;    // for FFmpeg filters
 static AVFrame* scaledFrame;    // for video
+static AVFrame* decodedAudioFrame;
+static AVFrame* filterAudioFrame;
+
+static PacketQueue videoPackets;
+static PacketQueue audioPackets;
 
 static struct SwsContext* rgbContext = NULL;
 static struct SwsContext* scalingContext = NULL;
 
 static int lastFrame = -1;
-static volatile bool useAVSeek = false;
-static volatile int64_t seekTimestamp = 0;
-
-
+static Demuxer demuxers[2];
+static int loadGeneration = 0;  // seek generation of video frames being loaded
+static int audioGeneration = 0; // seek generation of audio being decoded
+static int64_t seekTimestamp = 0;
+static Mutex seekMutex;
+static CondVar seekRequested;
+static int64_t lastLoadedTime = AV_NOPTS_VALUE;
+
+static int decodeSkipLevel = 0;
+static int decodeSkipPackets = 0; // packets in current window
+static int decodeSkipBehind = 0;  // packets in current window decoded while pipeline was behind
+static int decodeSkipCalmWindows = 0;
+static int decodeSkipWarmup = 0;  // windows left to be ignored
+
+psnip_atomic_int32 seekGeneration = 0;
+
+
+static ThreadRetType CP_CALL_CONV demuxThread(void* ptr);
+static ThreadRetType CP_CALL_CONV videoDecodeThread(void* ptr);
+static ThreadRetType CP_CALL_CONV audioDecodeThread(void* ptr);
+static void demuxLoop(Demuxer* demuxer);
+static void readInput(Demuxer* demuxer);
+static void seekInput(Demuxer* demuxer);
+static void startVideoGeneration(int generation);
 static AVFormatContext* loadContextAndStreams(const char* file);
 static void decodeVideoPacket(AVPacket* packet);
 static void decodeAudioPacket(AVPacket* packet);
 static void addVideoFrame(AVFrame* frame);
+static void scaleToQueue(AVFrame* inputFrame, int64_t pts);
+static Frame* getQueueFrame(int videoLinesize);
+static void pushQueueFrame(Frame* queueFrame, int64_t pts);
 static void refeshRgbFrame(AVFrame* inputFrame);
 static void refreshScaledFrame(AVFrame* swsInputFrame);
 static void scaleFrame(struct SwsContext* context, AVFrame* inputFrame, AVFrame* outputFrame);
+static bool receiveVideoFrame(void);
+static void updateDecodeSkip(void);
+static void setDecodeSkipLevel(int level);
 
 
 uint8_t* buffer;
@@ -85,6 +148,11 @@ static int64_t io_seek(void* opaque, int64_t offset, int whence)
 
 void initDecodeFrame(const char* file, const char* secondFile, Stream** outAudioStream)
 {
+	initMutex(&seekMutex);
+	initCondVar(&seekRequested);
+	initPacketQueue(&videoPackets, VIDEO_PACKET_QUEUE_SIZE);
+	initPacketQueue(&audioPackets, AUDIO_PACKET_QUEUE_SIZE);
+
 	if (settings.colorMode == CM_CSTD_16 ||
 		settings.colorMode == CM_CSTD_256 ||
 		settings.colorMode == CM_CSTD_RGB ||
@@ -121,15 +189,20 @@ void initDecodeFrame(const char* file, const char* secondFile, Stream** outAudio
 		{
 			error("Failed to copy video codec parameters to context", "decodeFrame.c", __LINE__);
 		}
+
+		setDecoderThreading(videoStream.codecContext);
 		if (avcodec_open2(videoStream.codecContext, videoStream.codec, NULL) < 0)
 		{
 			error("Failed to open video codec", "decodeFrame.c", __LINE__);
 		}
+		stats.decoderThreads = videoStream.codecContext->thread_count;
+		stats.decoderThreadType = videoStream.codecContext->active_thread_type;
 		vidW = videoStream.stream->codecpar->width;
 		vidH = videoStream.stream->codecpar->height;
 		fps = (double)videoStream.stream->r_frame_rate.num / (double)videoStream.stream->r_frame_rate.den;
 
 		if (settings.videoFilters) { initFiltersV(&videoStream); }
+		decodeSkipWarmup = DECODE_SKIP_WARMUP_WINDOWS;
 	}
 
 	if (audioStream.index != -1 && !settings.disableAudio)
@@ -155,6 +228,8 @@ void initDecodeFrame(const char* file, const char* secondFile, Stream** outAudio
 	rgbFrame = av_frame_alloc();
 	filterFrame = av_frame_alloc();
 	scaledFrame = av_frame_alloc();
+	decodedAudioFrame = av_frame_alloc();
+	filterAudioFrame = av_frame_alloc();
 
 	#ifndef CP_DISABLE_OPENGL
 	shStage1_init();
@@ -163,128 +238,224 @@ void initDecodeFrame(const char* file, const char* secondFile, Stream** outAudio
 
 void readFrames(void)
 {
-	double lastConRefresh = 0.0;
-
-	AVPacket* packet = av_packet_alloc();
-	double lastDTS = DBL_MIN;
-	int err1 = 0, err2 = 0;
+	// video and audio are decoded by their own threads and main thread reads input,
+	// with fake console main thread handles its window and input is read by another thread
+	if (videoStream.codecContext) { startThread(&videoDecodeThread, NULL); }
+	if (audioStream.codecContext) { startThread(&audioDecodeThread, NULL); }
+
+	demuxers[0].context = formatContext;
+	demuxers[0].primary = true;
+	demuxers[0].generation = 0;
+	if (secondFormatContext)
+	{
+		demuxers[1].context = secondFormatContext;
+		demuxers[1].primary = false;
+		demuxers[1].generation = 0;
+		startThread(&demuxThread, &demuxers[1]);
+	}
 
-	while (true)
+	#ifndef CP_DISABLE_OPENGL
+	if (settings.useFakeConsole)
 	{
-		#ifndef CP_DISABLE_OPENGL
-		if (settings.useFakeConsole) { peekMainMessages(); }
-		#endif
+		startThread(&demuxThread, &demuxers[0]);
 
-		while (freezeThreads)
+		double lastFontRefresh = 0.0;
+		while (true)
 		{
-			mainFreezed = true;
+			peekMainMessages();
 
-			#ifndef CP_DISABLE_OPENGL
-			if (settings.useFakeConsole) { peekMainMessages(); }
-			#endif
+			double curTime = getTime();
+			if (curTime > lastFontRefresh + CONSOLE_REFRESH_PERIOD)
+			{
+				refreshFont();
+				lastFontRefresh = curTime;
+			}
 
-			Sleep(SLEEP_ON_FREEZE);
+			Sleep(WINDOW_LOOP_PERIOD);
 		}
+	}
+	#endif
+
+	demuxLoop(&demuxers[0]);
+}
+
+void avSeek(int64_t timestamp)
+{
+	lockMutex(&seekMutex);
+	seekTimestamp = timestamp;
+	psnip_atomic_int32_add(&seekGeneration, 1);
+	wakeCondVar(&seekRequested);
+	unlockMutex(&seekMutex);
+
+	// draw thread would exit after dropping frames from before seek otherwise
+	setDecodeEnd(false, psnip_atomic_int32_load(&seekGeneration));
+
+	// demux thread can be waiting for space in packet queue
+	wakePacketQueue(&videoPackets);
+	wakePacketQueue(&audioPackets);
+}
+
+void setDecoderThreading(AVCodecContext* codecContext)
+{
+	// thread count 0 lets libavcodec choose it by number of CPU cores
+	codecContext->thread_count = settings.decoderThreads;
+	if (settings.decoderThreadType == DTT_FRAME) { codecContext->thread_type = FF_THREAD_FRAME; }
+	else if (settings.decoderThreadType == DTT_SLICE) { codecContext->thread_type = FF_THREAD_SLICE; }
+	else { codecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE; }
+}
+
+static ThreadRetType CP_CALL_CONV demuxThread(void* ptr)
+{
+	demuxLoop((Demuxer*)ptr);
+	CP_END_THREAD
+}
+
+static ThreadRetType CP_CALL_CONV videoDecodeThread(void* ptr)
+{
+	AVPacket* packet = av_packet_alloc();
+	double lastConRefresh = 0.0;
+
+	while (true)
+	{
+		int generation;
+		bool end = !getPacket(&videoPackets, packet, &generation);
 
-		if (useAVSeek)
+		if (generation != psnip_atomic_int32_load(&seekGeneration))
 		{
-			av_seek_frame(formatContext, -1, seekTimestamp, AVSEEK_FLAG_BACKWARD);
-			if (secondFormatContext) { av_seek_frame(secondFormatContext, -1, seekTimestamp, AVSEEK_FLAG_BACKWARD); }
-			useAVSeek = false;
+			av_packet_unref(packet);
+			continue;
 		}
+		if (generation != loadGeneration) { startVideoGeneration(generation); }
 
+		// frames are sized here, so console size can't change in the middle of loading frame
 		double curTime = getTime();
 		if (curTime > lastConRefresh + CONSOLE_REFRESH_PERIOD)
 		{
-			#ifndef CP_DISABLE_OPENGL
-			if (settings.useFakeConsole) { refreshFont(); }
-			#endif
-
 			refreshSize();
 			lastConRefresh = curTime;
 		}
 
-		bool decoded = false;
-		double dts = DBL_MIN;
-
-		while (true)
+		if (end)
 		{
-			if ((err1 = av_read_frame(formatContext, packet)) >= 0)
-			{
-				if (packet->stream_index == videoStream.index && formatContext == videoContext)
-				{
-					decodeVideoPacket(packet);
-					dts = (double)packet->dts * (double)videoStream.stream->time_base.num /
-						(double)videoStream.stream->time_base.den;
-				}
-				else if (packet->stream_index == audioStream.index && formatContext == audioContext)
-				{
-					decodeAudioPacket(packet);
-					dts = (double)packet->dts * (double)audioStream.stream->time_base.num /
-						(double)audioStream.stream->time_base.den;
-				}
+			// after taking remaining frames out of decoder draw thread exits when they are drawn,
+			// until then seek can still start loading again
+			decodeVideoPacket(NULL);
+			setDecodeEnd(true, generation);
+			continue;
+		}
 
-				av_packet_unref(packet);
-				decoded = true;
-			}
-			else
-			{
-				break;
-			}
+		decodeVideoPacket(packet);
+		av_packet_unref(packet);
+	}
 
-			if (dts > lastDTS || !secondFormatContext) { break; }
-		}
+	CP_END_THREAD
+}
 
-		lastDTS = dts;
+static ThreadRetType CP_CALL_CONV audioDecodeThread(void* ptr)
+{
+	AVPacket* packet = av_packet_alloc();
 
-		while (secondFormatContext)
-		{
-			if (secondFormatContext && (err2 = av_read_frame(secondFormatContext, packet)) >= 0)
-			{
-				if (packet->stream_index == videoStream.index && secondFormatContext == videoContext)
-				{
-					decodeVideoPacket(packet);
-					dts = (double)packet->dts * (double)videoStream.stream->time_base.num /
-						(double)videoStream.stream->time_base.den;
-				}
-				else if (packet->stream_index == audioStream.index && secondFormatContext == audioContext)
-				{
-					decodeAudioPacket(packet);
-					dts = (double)packet->dts * (double)audioStream.stream->time_base.num /
-						(double)audioStream.stream->time_base.den;
-				}
+	while (true)
+	{
+		int generation;
+		bool end = !getPacket(&audioPackets, packet, &generation);
 
-				av_packet_unref(packet);
-				decoded = true;
-			}
-			else
-			{
-				break;
-			}
+		if (end || generation != psnip_atomic_int32_load(&seekGeneration))
+		{
+			av_packet_unref(packet);
+			continue;
+		}
 
-			if (dts > lastDTS) { break; }
+		if (generation != audioGeneration)
+		{
+			// decoder still has samples from before seek
+			audioGeneration = generation;
+			avcodec_flush_buffers(audioStream.codecContext);
+			clearAudio();
 		}
 
-		lastDTS = dts;
-		if (!decoded) { break; }
+		decodeAudioPacket(packet);
+		av_packet_unref(packet);
 	}
 
-	av_packet_free(&packet);
+	CP_END_THREAD
+}
+
+static void demuxLoop(Demuxer* demuxer)
+{
+	bool readsVideo = videoStream.codecContext && demuxer->context == videoContext;
+	bool readsAudio = audioStream.codecContext && demuxer->context == audioContext;
 
-	decodeEnd = true;
 	while (true)
 	{
-		#ifndef CP_DISABLE_OPENGL
-		if (settings.useFakeConsole) { peekMainMessages(); }
-		#endif
-		Sleep(30);
+		readInput(demuxer);
+
+		// end markers let decoders finish, then reading waits for seek
+		if (readsVideo) { putPacket(&videoPackets, NULL, demuxer->generation); }
+		if (readsAudio) { putPacket(&audioPackets, NULL, demuxer->generation); }
+		if (demuxer->primary && !videoStream.codecContext) { setDecodeEnd(true, demuxer->generation); }
+
+		lockMutex(&seekMutex);
+		while (psnip_atomic_int32_load(&seekGeneration) == demuxer->generation)
+		{
+			waitCondVar(&seekRequested, &seekMutex);
+		}
+		unlockMutex(&seekMutex);
 	}
 }
 
-void avSeek(int64_t timestamp)
+static void readInput(Demuxer* demuxer)
 {
-	seekTimestamp = timestamp;
-	useAVSeek = true;
+	// packets go to queue of their stream and are decoded independently,
+	// so inputs don't have to be interleaved here, draw thread synchronizes video to audio by time
+	AVPacket* packet = av_packet_alloc();
+
+	while (true)
+	{
+		if (psnip_atomic_int32_load(&seekGeneration) != demuxer->generation) { seekInput(demuxer); }
+		if (av_read_frame(demuxer->context, packet) < 0) { break; }
+
+		if (packet->stream_index == videoStream.index && demuxer->context == videoContext &&
+			videoStream.codecContext)
+		{
+			putPacket(&videoPackets, packet, demuxer->generation);
+		}
+		else if (packet->stream_index == audioStream.index && demuxer->context == audioContext &&
+			audioStream.codecContext)
+		{
+			putPacket(&audioPackets, packet, demuxer->generation);
+		}
+
+		av_packet_unref(packet);
+	}
+
+	av_packet_free(&packet);
+}
+
+static void seekInput(Demuxer* demuxer)
+{
+	lockMutex(&seekMutex);
+	int64_t timestamp = seekTimestamp;
+	demuxer->generation = psnip_atomic_int32_load(&seekGeneration);
+	unlockMutex(&seekMutex);
+
+	av_seek_frame(demuxer->context, -1, timestamp, AVSEEK_FLAG_BACKWARD);
+
+	// decoders skip packets from before seek anyway, but there is no point in keeping them
+	if (demuxer->context == videoContext) { flushPacketQueue(&videoPackets); }
+	if (demuxer->context == audioContext) { flushPacketQueue(&audioPackets); }
+}
+
+static void startVideoGeneration(int generation)
+{
+	// first packet after seek, decoder still has frames from before it
+	loadGeneration = generation;
+	avcodec_flush_buffers(videoStream.codecContext);
+
+	decodeSkipPackets = 0;
+	decodeSkipBehind = 0;
+	decodeSkipWarmup = DECODE_SKIP_WARMUP_WINDOWS;
+	lastLoadedTime = AV_NOPTS_VALUE;
 }
 
 static AVFormatContext* loadContextAndStreams(const char* file)
@@ -349,9 +520,14 @@ static AVFormatContext* loadContextAndStreams(const char* file)
 
 static void decodeVideoPacket(AVPacket* packet)
 {
-	if (avcodec_send_packet(videoStream.codecContext, packet) < 0) { return; }
+	updateDecodeSkip();
 
-	while (avcodec_receive_frame(videoStream.codecContext, decodedFrame) >= 0)
+	int64_t decodeStart = getTimeNs();
+	int retVal = avcodec_send_packet(videoStream.codecContext, packet);
+	stats.decodeTime += getTimeNs() - decodeStart;
+	if (retVal < 0) { return; }
+
+	while (receiveVideoFrame())
 	{
 		AVFrame* inputFrame = decodedFrame;
 
@@ -379,7 +555,7 @@ static void decodeVideoPacket(AVPacket* packet)
 
 				while (getFilteredFrameSV(filterFrame))
 				{
-					filterFrame->pts = inputFrame->pts;
+					filterFrame->pts = inputFrame->best_effort_timestamp;
 					addVideoFrame(filterFrame);
 					av_frame_unref(filterFrame);
 				}
@@ -391,11 +567,7 @@ static void decodeVideoPacket(AVPacket* packet)
 
 			while (getFilteredFrameV(filterFrame))
 			{
-				refreshScaledFrame(filterFrame);
-				scaleFrame(scalingContext, filterFrame, scaledFrame);
-				scaledFrame->pts = inputFrame->pts;
-				addVideoFrame(scaledFrame);
-
+				scaleToQueue(filterFrame, inputFrame->best_effort_timestamp);
 				av_frame_unref(filterFrame);
 			}
 		}
@@ -408,17 +580,14 @@ static void decodeVideoPacket(AVPacket* packet)
 
 			while (getFilteredFrameSV(filterFrame))
 			{
-				filterFrame->pts = inputFrame->pts;
+				filterFrame->pts = inputFrame->best_effort_timestamp;
 				addVideoFrame(filterFrame);
 				av_frame_unref(filterFrame);
 			}
 		}
 		else
 		{
-			refreshScaledFrame(inputFrame);
-			scaleFrame(scalingContext, inputFrame, scaledFrame);
-			scaledFrame->pts = inputFrame->pts;
-			addVideoFrame(scaledFrame);
+			scaleToQueue(inputFrame, inputFrame->best_effort_timestamp);
 		}
 	}
 }
@@ -428,60 +597,116 @@ static void decodeAudioPacket(AVPacket* packet)
 	if (settings.disableAudio) { return; }
 	if (avcodec_send_packet(audioStream.codecContext, packet) < 0) { return; }
 
-	while (avcodec_receive_frame(audioStream.codecContext, decodedFrame) >= 0)
+	while (avcodec_receive_frame(audioStream.codecContext, decodedAudioFrame) >= 0)
 	{
+		int64_t time = decodedAudioFrame->best_effort_timestamp;
+		if (time != AV_NOPTS_VALUE) { time = av_rescale_q(time, audioStream.stream->time_base, AV_TIME_BASE_Q); }
+
 		if (settings.audioFilters)
 		{
-			applyFiltersA(decodedFrame);
+			applyFiltersA(decodedAudioFrame);
 
-			while (getFilteredFrameA(filterFrame))
+			// filters can change number of samples, so only first frame gets decoded frame time
+			while (getFilteredFrameA(filterAudioFrame))
 			{
-				addAudioFrame(filterFrame);
-				av_frame_unref(filterFrame);
+				addAudioFrame(filterAudioFrame, time, audioGeneration);
+				time = AV_NOPTS_VALUE;
+				av_frame_unref(filterAudioFrame);
 			}
 		}
 		else
 		{
-			addAudioFrame(decodedFrame);
+			addAudioFrame(decodedAudioFrame, time, audioGeneration);
 		}
 	}
 }
 
 static void addVideoFrame(AVFrame* frame)
 {
-	Frame* queueFrame = dequeueFrame(STAGE_FREE, &mainFreezed);
+	Frame* queueFrame = getQueueFrame(frame->linesize[0]);
+	memcpy(queueFrame->videoFrame, frame->data[0], frame->linesize[0] * conH);
+	pushQueueFrame(queueFrame, frame->pts);
+}
+
+static void scaleToQueue(AVFrame* inputFrame, int64_t pts)
+{
+	// without scaled video filters frame is scaled straight into queue slot
+	int64_t scaleStart;
+
+	// area scaling mode reads decoded planes directly, swscale is used for other pixel formats,
+	// auto mode does it only with luma plane in gray color modes and uses bicubic swscale otherwise
+	bool scaleGray = (settings.scalingMode == SM_AREA || settings.scalingMode == SM_AUTO) &&
+		destFormat == AV_PIX_FMT_GRAY8 && canScaleLuma(inputFrame, conW, conH);
+	bool scaleColor = settings.scalingMode == SM_AREA && destFormat == AV_PIX_FMT_RGB24 &&
+		canScaleYuv(inputFrame, conW, conH);
+
+	if (scaleGray || scaleColor)
+	{
+		Frame* queueFrame = getQueueFrame(scaleGray ? conW : conW * 3);
+
+		scaleStart = getTimeNs();
+		if (scaleGray) { scaleLuma(inputFrame, queueFrame->videoFrame, queueFrame->videoLinesize, conW, conH); }
+		else { scaleYuvToRgb(inputFrame, queueFrame->videoFrame, queueFrame->videoLinesize, conW, conH); }
+		stats.scaleTime += getTimeNs() - scaleStart;
+		stats.directScaledFrames++;
+
+		pushQueueFrame(queueFrame, pts);
+		return;
+	}
+
+	refreshScaledFrame(inputFrame);
+	Frame* queueFrame = getQueueFrame(scaledFrame->linesize[0]);
+
+	uint8_t* dstData[4] = { queueFrame->videoFrame, NULL, NULL, NULL };
+	int dstLinesize[4] = { queueFrame->videoLinesize, 0, 0, 0 };
+
+	scaleStart = getTimeNs();
+	sws_scale(scalingContext, (const uint8_t* const*)inputFrame->data, inputFrame->linesize, 0,
+		inputFrame->height, dstData, dstLinesize);
+	stats.scaleTime += getTimeNs() - scaleStart;
+	stats.swsScaledFrames++;
+
+	pushQueueFrame(queueFrame, pts);
+}
+
+static Frame* getQueueFrame(int videoLinesize)
+{
+	Frame* queueFrame = dequeueFrame(STAGE_FREE);
+	queueFrame->generation = loadGeneration;
 
 	if (queueFrame->w != conW ||
 		queueFrame->h != conH ||
-		queueFrame->videoLinesize != frame->linesize[0])
+		queueFrame->videoLinesize != videoLinesize)
 	{
-		if (queueFrame->outputLineOffsets) { free(queueFrame->outputLineOffsets); }
-		if (queueFrame->output) { free(queueFrame->output); }
-		if (queueFrame->videoFrame) { free(queueFrame->videoFrame); }
-
 		queueFrame->w = conW;
 		queueFrame->h = conH;
-		queueFrame->videoLinesize = frame->linesize[0];
-		queueFrame->videoFrame = (uint8_t*)malloc(frame->linesize[0] * conH);
-		queueFrame->output = malloc(getOutputArraySize(conW, conH));
-		queueFrame->outputLineOffsets = malloc((conH + 1) * sizeof(int));
+		queueFrame->videoLinesize = videoLinesize;
+		queueFrame->videoFrame = (uint8_t*)poolResize(queueFrame->videoFrame, videoLinesize * conH);
 	}
 
-	memcpy(queueFrame->videoFrame, frame->data[0], frame->linesize[0] * conH);
+	// output buffers can be exchanged with console frames (see drawThread),
+	// so their size doesn't have to match slot size and is checked every time
+	queueFrame->output = poolResize(queueFrame->output, getOutputArraySize(conW, conH));
+	queueFrame->outputLineOffsets = (int*)poolResize(queueFrame->outputLineOffsets, (conH + 1) * sizeof(int));
+	if (settings.deltaDraw) { queueFrame->cells = (Cell*)poolResize(queueFrame->cells, conW * conH * sizeof(Cell)); }
 
-	queueFrame->time = (int64_t)(((double)frame->pts /
-		(double)videoStream.stream->time_base.den) * (double)AV_TIME_BASE);
-	queueFrame->isAudio = false;
+	return queueFrame;
+}
 
-	enqueueFrame(STAGE_LOADED_FRAME);
+static void pushQueueFrame(Frame* queueFrame, int64_t pts)
+{
+	// pts is in stream time base, frames without it keep AV_NOPTS_VALUE and are paced by frame rate
+	queueFrame->time = pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+		av_rescale_q(pts, videoStream.stream->time_base, AV_TIME_BASE_Q);
+	if (queueFrame->time != AV_NOPTS_VALUE) { lastLoadedTime = queueFrame->time; }
+
+	enqueueFrame(queueFrame, STAGE_LOADED_FRAME);
 }
 
 static void refeshRgbFrame(AVFrame* inputFrame)
 {
 	static int lastFrameW = -1, lastFrameH = -1;
 	static enum AVPixelFormat lastPixelFormat = AV_PIX_FMT_NONE;
-	static uint8_t* rgbFrameBuffer = NULL;
-
 	const enum AVPixelFormat RGB_PIXEL_FORMAT = AV_PIX_FMT_RGB24;
 
 	int w = inputFrame->width;
@@ -494,11 +719,9 @@ static void refeshRgbFrame(AVFrame* inputFrame)
 		lastFrameH = h;
 		lastPixelFormat = format;
 
-		if (rgbContext) { sws_freeContext(rgbContext); }
-		if (rgbFrameBuffer) { av_free(rgbFrameBuffer); }
-
-		rgbContext = sws_getContext(w, h, format, w, h, RGB_PIXEL_FORMAT, SWS_POINT, NULL, NULL, NULL);
-		rgbFrameBuffer = av_malloc(av_image_get_buffer_size(RGB_PIXEL_FORMAT, w, h, 1) * sizeof(uint8_t));
+		uint8_t* rgbFrameBuffer;
+		releaseSwsContext(rgbContext);
+		rgbContext = getSwsContext(w, h, format, w, h, RGB_PIXEL_FORMAT, SWS_POINT, &rgbFrameBuffer);
 
 		av_image_fill_arrays(rgbFrame->data, rgbFrame->linesize, rgbFrameBuffer, RGB_PIXEL_FORMAT, w, h, 1);
 		av_frame_copy_props(rgbFrame, inputFrame);
@@ -515,7 +738,6 @@ static void refreshScaledFrame(AVFrame* inputFrame)
 	static int lastW = -1, lastH = -1;
 	static int lastConW = -1, lastConH = -1;
 	static enum AVPixelFormat lastPixelFormat = AV_PIX_FMT_NONE;
-	static uint8_t* scaledFrameBuffer = NULL;
 
 	int w = inputFrame->width;
 	int h = inputFrame->height;
@@ -530,9 +752,6 @@ static void refreshScaledFrame(AVFrame* inputFrame)
 		lastConH = conH;
 		lastPixelFormat = format;
 
-		if (scalingContext) { sws_freeContext(scalingContext); }
-		if (scaledFrameBuffer) { av_free(scaledFrameBuffer); }
-		
 		int flags;
 		switch (settings.scalingMode)
 		{
@@ -540,13 +759,24 @@ static void refreshScaledFrame(AVFrame* inputFrame)
 		case SM_FAST_BILINEAR: flags = SWS_FAST_BILINEAR; break;
 		case SM_BILINEAR: flags = SWS_BILINEAR; break;
 		case SM_BICUBIC: flags = SWS_BICUBIC; break;
+		case SM_AREA: flags = SWS_AREA; break;
+		case SM_AUTO: flags = SWS_BICUBIC; break;
 		default: error("Undefined scaling mode!", "decodeFrame.c", __LINE__);
 		}
 
-		scalingContext = sws_getContext(w, h, format, conW, conH, destFormat, flags, NULL, NULL, NULL);
-		scaledFrameBuffer = av_malloc(av_image_get_buffer_size(destFormat, conW, conH, 1) * sizeof(uint8_t));
-		
-		av_image_fill_arrays(scaledFrame->data, scaledFrame->linesize, scaledFrameBuffer, destFormat, conW, conH, 1);
+		releaseSwsContext(scalingContext);
+		if (settings.scaledVideoFilters)
+		{
+			uint8_t* scaledFrameBuffer;
+			scalingContext = getSwsContext(w, h, format, conW, conH, destFormat, flags, &scaledFrameBuffer);
+			av_image_fill_arrays(scaledFrame->data, scaledFrame->linesize, scaledFrameBuffer, destFormat, conW, conH, 1);
+		}
+		else
+		{
+			// frames are scaled into queue slots, only line size is needed
+			scalingContext = getSwsContext(w, h, format, conW, conH, destFormat, flags, NULL);
+			av_image_fill_linesizes(scaledFrame->linesize, destFormat, conW);
+		}
 		av_frame_copy_props(scaledFrame, inputFrame);
 
 		scaledFrame->width = conW;
@@ -563,4 +793,72 @@ static void scaleFrame(struct SwsContext* context, AVFrame* inputFrame, AVFrame*
 	sws_scale(context, (const uint8_t* const*)inputFrame->data, inputFrame->linesize, 0,
 		inputFrame->height, outputFrame->data, outputFrame->linesize);
 	av_frame_copy_props(outputFrame, inputFrame);
+}
+
+static bool receiveVideoFrame(void)
+{
+	// only time spent in decoder is measured, not scaling and waiting for queue
+	int64_t decodeStart = getTimeNs();
+	bool received = avcodec_receive_frame(videoStream.codecContext, decodedFrame) >= 0;
+	int64_t receiveTime = getTimeNs();
+	stats.decodeTime += receiveTime - decodeStart;
+
+	if (received)
+	{
+		if (!stats.decodedFrames) { stats.firstDecodedTime = receiveTime; }
+		stats.lastDecodedTime = receiveTime;
+		stats.decodedFrames++;
+	}
+	return received;
+}
+
+static void updateDecodeSkip(void)
+{
+	if (!settings.adaptiveSkip || settings.syncMode != SYNC_ENABLED) { return; }
+
+	stats.decodePackets++;
+	if (decodeSkipLevel) { stats.decodeSkipPackets++; }
+
+	// pipeline is behind when draw thread has almost nothing to draw,
+	// or when frames are already late at the time they are loaded
+	int64_t audioTime;
+	if (getQueueFill() <= 1 ||
+		(lastLoadedTime != AV_NOPTS_VALUE && getAudioClock(&audioTime) && lastLoadedTime < audioTime))
+	{
+		decodeSkipBehind++;
+	}
+
+	if (++decodeSkipPackets < DECODE_SKIP_WINDOW) { return; }
+
+	if (decodeSkipWarmup) { decodeSkipWarmup--; }
+	else if (decodeSkipBehind * 2 >= DECODE_SKIP_WINDOW)
+	{
+		decodeSkipCalmWindows = 0;
+		setDecodeSkipLevel(decodeSkipLevel + 1);
+	}
+	else if (decodeSkipBehind) { decodeSkipCalmWindows = 0; }
+	else if (++decodeSkipCalmWindows >= DECODE_SKIP_CALM_WINDOWS)
+	{
+		decodeSkipCalmWindows = 0;
+		setDecodeSkipLevel(decodeSkipLevel - 1);
+	}
+
+	decodeSkipPackets = 0;
+	decodeSkipBehind = 0;
+}
+
+static void setDecodeSkipLevel(int level)
+{
+	level = cp_clamp(level, 0, DECODE_SKIP_LEVEL_COUNT - 1);
+	if (level == decodeSkipLevel) { return; }
+	decodeSkipLevel = level;
+
+	// used by decoder from next packet
+	videoStream.codecContext->skip_loop_filter = DECODE_SKIP_LEVELS[level].skipLoopFilter;
+	videoStream.codecContext->skip_idct = DECODE_SKIP_LEVELS[level].skipIdct;
+	videoStream.codecContext->skip_frame = DECODE_SKIP_LEVELS[level].skipFrame;
+
+	stats.decodeSkipLevel = level;
+	stats.decodeSkipChanges++;
+	if (level > stats.decodeSkipMaxLevel) { stats.decodeSkipMaxLevel = level; }
 }
\ No newline at end of file
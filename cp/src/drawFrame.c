@@ -7,9 +7,34 @@ typedef struct
 	double fontRatio;
 } ConsoleInfo;
 
+// what is currently displayed, for delta drawing
+typedef struct
+{
+	Cell* cells;
+	int w, h;
+	int framesToRedraw;
+	int cursorX, cursorY; // -1 when unknown
+	Cell color;           // last written SGR color
+	char* buffer;
+	size_t bufferSize;
+} DeltaState;
+
+// "\x1B[row;columnH" with 5 digit numbers
+static const int MAX_CURSOR_MOVE_LEN = 14;
+// writeCellColor() can write up to 19 bytes
+static const int MAX_CELL_LEN = 20;
+
 HANDLE outputHandle = NULL;
+static DeltaState delta = { NULL, -1, -1, 0, -1, -1, { 0,0,0,0 }, NULL, 0 };
+// set by refreshSize() when console size changes, resized console doesn't keep what was displayed
+static psnip_atomic_int32 deltaConsoleResized = 0;
 
 static void drawWithWinAPI(CHAR_INFO* output, int w, int h);
+static void drawDelta(char* output, int* lineOffsets, Cell* cells, int w, int h);
+static char* moveCursor(char* buffer, const Cell* row, int x, int y);
+static char* writeCell(char* buffer, const Cell* cell);
+static int rewriteCost(const Cell* cells, int count, int limit);
+static bool sameColor(const Cell* a, const Cell* b);
 static void getConsoleInfo(ConsoleInfo* consoleInfo);
 static void setConstColor(void);
 
@@ -147,10 +172,16 @@ void refreshSize(void)
 		}
 	}
 
+	if (consoleInfo.w != oldConsoleInfo.w ||
+		consoleInfo.h != oldConsoleInfo.h)
+	{
+		CP_ATOMIC_STORE_RELEASE(&deltaConsoleResized, 1);
+	}
+
 	oldConsoleInfo = consoleInfo;
 }
 
-void drawFrame(void* output, int* lineOffsets, int w, int h)
+void drawFrame(void* output, int* lineOffsets, Cell* cells, int w, int h)
 {
 	static int scanline = 0;
 	static int lastW = -1, lastH = -1;
@@ -177,11 +208,17 @@ void drawFrame(void* output, int* lineOffsets, int w, int h)
 	}
 
 	setConstColor();
+	stats.drawnFrames++;
 
-	if (settings.scanlineCount == 1)
+	if (cells)
+	{
+		drawDelta((char*)output, lineOffsets, cells, w, h);
+	}
+	else if (settings.scanlineCount == 1)
 	{
 		if (!settings.disableCLS) { setCursorPos(0, 0); }
 		fwrite(output, 1, lineOffsets[h], stdout);
+		stats.drawnBytes += lineOffsets[h];
 	}
 	else
 	{
@@ -194,6 +231,7 @@ void drawFrame(void* output, int* lineOffsets, int w, int h)
 
 			if (!settings.disableCLS) { setCursorPos(0, sy); }
 			fwrite((char*)output + lineOffsets[sy], 1, lineOffsets[sy + sh] - lineOffsets[sy], stdout);
+			stats.drawnBytes += lineOffsets[sy + sh] - lineOffsets[sy];
 		}
 
 		scanline++;
@@ -236,6 +274,146 @@ static void drawWithWinAPI(CHAR_INFO* output, int w, int h)
 	#endif
 }
 
+static void drawDelta(char* output, int* lineOffsets, Cell* cells, int w, int h)
+{
+	int cellCount = w * h;
+
+	if (delta.w != w || delta.h != h)
+	{
+		delta.w = w;
+		delta.h = h;
+		delta.cells = (Cell*)realloc(delta.cells, cellCount * sizeof(Cell));
+		delta.bufferSize = ((size_t)cellCount * (MAX_CURSOR_MOVE_LEN + MAX_CELL_LEN)) + 32;
+		delta.buffer = (char*)realloc(delta.buffer, delta.bufferSize);
+		delta.framesToRedraw = 0;
+
+		if (!delta.cells || !delta.buffer) { error("Failed to allocate delta drawing buffers!", "drawFrame.c", __LINE__); }
+	}
+
+	if (CP_ATOMIC_EXCHANGE(&deltaConsoleResized, 0)) { delta.framesToRedraw = 0; }
+
+	if (delta.framesToRedraw <= 0)
+	{
+		// whole frame - every row of it starts with color code, so color of the last cell stays set
+		// and cursor stays behind it (last new line is removed by processFrame())
+		setCursorPos(0, 0);
+		fwrite(output, 1, lineOffsets[h], stdout);
+		fflush(stdout);
+
+		memcpy(delta.cells, cells, cellCount * sizeof(Cell));
+		delta.cursorX = w;
+		delta.cursorY = h - 1;
+		delta.color = cells[cellCount - 1];
+		delta.framesToRedraw = settings.deltaRefreshInterval ? settings.deltaRefreshInterval : INT_MAX;
+
+		stats.fullRedraws++;
+		stats.drawnBytes += lineOffsets[h];
+		return;
+	}
+
+	delta.framesToRedraw--;
+	char* buffer = delta.buffer;
+
+	for (int y = 0; y < h; y++)
+	{
+		Cell* row = cells + (y * w);
+		Cell* shownRow = delta.cells + (y * w);
+
+		for (int x = 0; x < w; x++)
+		{
+			if (!memcmp(&row[x], &shownRow[x], sizeof(Cell))) { continue; }
+
+			buffer = moveCursor(buffer, row, x, y);
+			buffer = writeCell(buffer, &row[x]);
+			shownRow[x] = row[x];
+		}
+	}
+
+	// stdout is line buffered in terminal and delta can have no new lines at all
+	fwrite(delta.buffer, 1, buffer - delta.buffer, stdout);
+	fflush(stdout);
+	stats.drawnBytes += buffer - delta.buffer;
+}
+
+static char* moveCursor(char* buffer, const Cell* row, int x, int y)
+{
+	if (delta.cursorX == x && delta.cursorY == y) { return buffer; }
+
+	// escape sequence is compared with writing again unchanged characters between cursor and
+	// target, in the same row or after new line when target is in the next row
+	char move[32];
+	int moveLen, rewriteStart = -1, newLineLen = 0;
+
+	if (delta.cursorY == y && delta.cursorX >= 0 && delta.cursorX < x)
+	{
+		moveLen = sprintf(move, "\x1B[%dC", x - delta.cursorX);
+		rewriteStart = delta.cursorX;
+	}
+	else
+	{
+		if (x == 0) { moveLen = sprintf(move, "\x1B[%dH", y + 1); }
+		else { moveLen = sprintf(move, "\x1B[%d;%dH", y + 1, x + 1); }
+
+		if (delta.cursorY >= 0 && delta.cursorY == y - 1)
+		{
+			rewriteStart = 0;
+			newLineLen = 1;
+		}
+	}
+
+	if (rewriteStart != -1 && newLineLen + rewriteCost(row + rewriteStart, x - rewriteStart, moveLen - newLineLen) < moveLen)
+	{
+		if (newLineLen) { *buffer++ = '\n'; }
+		delta.cursorX = rewriteStart;
+		delta.cursorY = y;
+
+		for (int i = rewriteStart; i < x; i++) { buffer = writeCell(buffer, &row[i]); }
+		return buffer;
+	}
+
+	memcpy(buffer, move, moveLen);
+	delta.cursorX = x;
+	delta.cursorY = y;
+	return buffer + moveLen;
+}
+
+static char* writeCell(char* buffer, const Cell* cell)
+{
+	if (!sameColor(cell, &delta.color))
+	{
+		buffer += writeCellColor(buffer, cell);
+		delta.color = *cell;
+	}
+
+	*buffer = cell->ch;
+	delta.cursorX++;
+	return buffer + 1;
+}
+
+static int rewriteCost(const Cell* cells, int count, int limit)
+{
+	// bytes needed to write cells again, counting stops at limit
+	Cell color = delta.color;
+	int cost = 0;
+
+	for (int i = 0; i < count && cost < limit; i++)
+	{
+		if (!sameColor(&cells[i], &color))
+		{
+			cost += writeCellColor(NULL, &cells[i]);
+			color = cells[i];
+		}
+		cost++;
+	}
+
+	return cost;
+}
+
+static bool sameColor(const Cell* a, const Cell* b)
+{
+	return a->r == b->r && a->g == b->g && a->b == b->b;
+}
+
 static void getConsoleInfo(ConsoleInfo* consoleInfo)
 {
 	const double DEFAULT_FONT_RATIO = 8.0 / 18.0;
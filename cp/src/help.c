@@ -11,6 +11,7 @@ static void helpBasicOptions(void);
 static void helpAdvancedOptions(void);
 static void helpModes(void);
 static void helpKeyboard(void);
+static void printDecoderThreading(void);
 
 void showHelp(bool basic, bool advanced, bool modes, bool keyboard)
 {
@@ -45,7 +46,11 @@ void showFullInfo(void)
 	puts("Compiler: [unknown]");
 	#endif
 	
-	printf("Libav: Libav %s [%s]", av_version_info(), avutil_configuration());
+	printf("Libav: Libav %s [%s]\n", av_version_info(), avutil_configuration());
+	printf("CPU cores: %d\n", getCpuCount());
+	initSimd();
+	printf("SIMD: %s\n", getSimdName());
+	printDecoderThreading();
 }
 
 void showVersion(void)
@@ -53,6 +58,37 @@ void showVersion(void)
 	puts(CP_VERSION_STRING);
 }
 
+static void printDecoderThreading(void)
+{
+	// -fi can't be used with other options, so settings have default values -
+	// H.264 decoder is opened with them to show what libavcodec chooses on this machine
+	char threads[16];
+	if (settings.decoderThreads) { snprintf(threads, sizeof(threads), "%d", settings.decoderThreads); }
+	else { strcpy(threads, "auto"); }
+
+	const char* threadType = "auto";
+	if (settings.decoderThreadType == DTT_FRAME) { threadType = "frame"; }
+	else if (settings.decoderThreadType == DTT_SLICE) { threadType = "slice"; }
+
+	printf("Video decoder threading: %s threads, %s type", threads, threadType);
+
+	const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+	AVCodecContext* codecContext = codec ? avcodec_alloc_context3(codec) : NULL;
+	if (!codecContext)
+	{
+		printf(" [H.264 decoder not available]");
+		return;
+	}
+
+	setDecoderThreading(codecContext);
+	if (avcodec_open2(codecContext, codec, NULL) >= 0)
+	{
+		printf(" [H.264: %d threads, %s]", codecContext->thread_count,
+			getDecoderThreadTypeName(codecContext->active_thread_type));
+	}
+	avcodec_free_context(&codecContext);
+}
+
 static void helpBasicOptions(void)
 {
 	puts(
@@ -123,7 +159,15 @@ static void helpAdvancedOptions(void)
 		"                      conpl video.mp4 -r 20\n"
 		"                      conpl video.mp4 -r @40\n"
 		"                      conpl video.mp4 -c cstd-rgb -cp char-only -r 56\n"
-		" -sm [mode]          Sets scaling mode. Default scaling mode is \"bicubic\".\n"
+		" -gm [gamma]         Sets gamma of brightness used for choosing characters. Default is 1.0,\n"
+		"  (--gamma)          higher values make image brighter.\n"
+		"                     Examples:\n"
+		"                      conpl video.mp4 -gm 1.5\n"
+		" -ct [contrast]      Sets contrast of brightness used for choosing characters. Default is 1.0.\n"
+		"  (--contrast)       Examples:\n"
+		"                      conpl video.mp4 -ct 1.2\n"
+		"                      conpl video.mp4 -gm 0.8 -ct 1.5\n"
+		" -sm [mode]          Sets scaling mode. Default scaling mode is \"auto\".\n"
 		"  (--scaling-mode)   To get list of all available modes use \"conpl -h modes\".\n"
 		"                     Examples:\n"
 		"                      conpl video.mp4 -sm nearest\n"
@@ -154,6 +198,14 @@ static void helpAdvancedOptions(void)
 		"                     Works properly only in \"cstd\" color mode and it breaks interlacing.\n"
 		"                     Examples:\n"
 		"                      conpl video.mp4 -c cstd-gray -s 80 30 -fr 0.5 -sy disabled -dcls > output.txt\n"
+		" -dd <interval>      Draws only characters that changed since the previous frame, cursor jumps\n"
+		"  (--delta-draw)     over unchanged ones. Reduces amount of written data, mostly useful over SSH.\n"
+		"                     Whole frame is still drawn after resizing and every \"interval\" frames\n"
+		"                     (by default 250, 0 - only after resizing). Works only in \"cstd\" color modes\n"
+		"                     and without \"set color\" mode.\n"
+		"                     Examples:\n"
+		"                      conpl video.mp4 -c cstd-rgb -dd\n"
+		"                      conpl video.mp4 -dd 100\n"
 		" -fc                 Creates child window on top of the console that looks like console but\n"
 		"  (--fake-console)   renders text much faster using OpenGL. Currently works only on Windows\n"
 		"                     and may be unstable! Recommended to use with raster font.\n"
@@ -174,7 +226,26 @@ static void helpAdvancedOptions(void)
 		" -xs                 Sets extractor command suffix. By default: \"2>&1\".\n"
 		"  (--extractor-      Examples:\n"
 		"   suffix)            conpl $https://www.youtube.com/watch?v=FtutLA63Cp8 -xs \"\"\n"
+		" -sth [ms]           Sets how late video can be compared to audio before frames are dropped.\n"
+		"  (--sync-threshold) By default 100 ms. Frames are never dropped with \"draw-all\" synchronization.\n"
+		" -ads                When playback falls behind, decoder skips deblocking, then IDCT of non-reference\n"
+		"  (--adaptive-skip)  frames and then whole non-reference and non-key frames. Works only with\n"
+		"                     \"enabled\" synchronization. Artifacts are hardly visible at console resolutions.\n"
+		" -dt [count]         Sets number of video decoder threads.\n"
+		"  (--decoder-threads)By default (or when set to 0) it's chosen by Libav depending on number of CPU cores.\n"
+		" -dtt [type]         Sets video decoder threading type.\n"
+		"  (--decoder-thread- To get list of all available types use \"conpl -h modes\".\n"
+		"   type)             Examples:\n"
+		"                      conpl udp://127.0.0.1:1234 -dtt slice\n"
 		" -pl (--preload)     Loads and unload entire input file (in hope that system will cache it into RAM).\n"
+		" -pt [count]         Sets number of threads converting frames to characters.\n"
+		"  (--proc-threads)   By default (or when set to 0) it depends on number of CPU cores.\n"
+		" -qd [min] [max]     Sets minimum and maximum number of frames in the queue. By default 8 and 64.\n"
+		"  (--queue-depth)    Queue grows when frames are late and shrinks when playback is steady.\n"
+		" -qm [MB]            Sets memory budget of the queue. Minimum queue depth has priority over it.\n"
+		"  (--queue-mem)      By default (or when set to 0) there is no limit.\n"
+		" -hp (--huge-pages)  Uses huge pages for big frame buffers when system allows it.\n"
+		" -st (--stats)       Prints statistics (like queue depth and occupancy) on exit.\n"
 		" -da(--disable-audio)Disables audio.\n"
 		" -dk (--disable-keys)Disables keyboard control.\n"
 		" -avl (--libav-logs) Enables printing Libav logs. Helpful with FFmpeg filters problems.\n"
@@ -204,13 +275,24 @@ static void helpModes(void)
 		" >nearest\n"
 		" >fast-bilinear\n"
 		" >bilinear\n"
-		" >bicubic [default]\n");
+		" >bicubic\n"
+		" >area - averages all pixels covered by character, reads YUV planes of\n"
+		"         decoded frame directly, without swscale.\n"
+		" >auto - area for gray color modes if luma plane can be read directly,\n"
+		"         bicubic otherwise. [default]\n");
 
 	puts(
 		"Synchronization modes:\n"
 		" >disabled - prints the output as fast as possible.\n"
 		" >draw-all - synchronization enabled, but tries to draw all frames.\n"
 		" >enabled - synchronization enabled, skips frames if necessary. [default]\n");
+
+	puts(
+		"Decoder threading types:\n"
+		" >auto - frame threading if codec supports it, otherwise slice threading. [default]\n"
+		" >frame - decodes multiple frames at once, adds delay of one frame per thread.\n"
+		" >slice - decodes slices of a single frame at once, low latency (good for live input),\n"
+		"          but many videos have only one slice per frame.\n");
 }
 
 static void helpKeyboard(void)
@@ -1,7 +1,5 @@
 #include "conplayer.h"
 
-const int QUEUE_SIZE = 64;
-
 HWND conHWND = NULL, wtDragBarHWND = NULL;
 int conW = -1, conH = -1;
 int vidW = -1, vidH = -1;
@@ -22,9 +20,14 @@ Settings settings =
 	.setColorVal1 = 0, .setColorVal2 = 0,
 	.constFontRatio = 0.0,
 	.brightnessRand = 0,
-	.scalingMode = SM_BICUBIC,
+	.gamma = 1.0, .contrast = 1.0,
+	.scalingMode = SM_AUTO,
 	.colorProcMode = CPM_BOTH,
 	.syncMode = SYNC_ENABLED,
+	.syncThreshold = 100,
+	.adaptiveSkip = false,
+	.decoderThreads = 0,
+	.decoderThreadType = DTT_AUTO,
 	.videoFilters = NULL,
 	.scaledVideoFilters = NULL,
 	.audioFilters = NULL,
@@ -32,8 +35,15 @@ Settings settings =
 	.useFakeConsole = false,
 	.disableKeyboard = false,
 	.disableCLS = false,
+	.deltaDraw = false,
+	.deltaRefreshInterval = 250,
 	.disableAudio = false,
-	.libavLogs = false
+	.libavLogs = false,
+	.procThreads = 0,
+	.queueMinDepth = 8, .queueMaxDepth = 64,
+	.queueMem = 0,
+	.hugePages = false,
+	.printStats = false
 };
 
 void load()
@@ -48,8 +58,11 @@ void load()
 	if (settings.useFakeConsole) { initOpenGlConsole(); }
 	#endif
 
+	initSimd();
 	initDecodeFrame(inputFile, secondInputFile, &audioStream);
 	initDrawFrame();
+	initProcessFrame();
+	initBufferPool();
 	initQueue();
 	if (!settings.disableAudio) { initAudio(audioStream); }
 
@@ -0,0 +1,97 @@
+#include "conplayer.h"
+
+// Bounded FIFO of packets between a demux thread and a decode thread. Every packet carries
+// seek generation it was read in, so decoders can recognize and skip packets from before seek.
+// Packets are moved in and out of preallocated AVPackets, nothing is allocated per packet.
+
+static bool isStale(int generation);
+
+void initPacketQueue(PacketQueue* queue, int size)
+{
+	queue->size = size;
+	queue->front = 0;
+	queue->count = 0;
+	queue->packets = (QueuedPacket*)malloc(size * sizeof(QueuedPacket));
+
+	for (int i = 0; i < size; i++)
+	{
+		queue->packets[i].packet = av_packet_alloc();
+		queue->packets[i].generation = 0;
+		queue->packets[i].end = false;
+	}
+
+	initMutex(&queue->mutex);
+	initCondVar(&queue->packetAdded);
+	initCondVar(&queue->packetRemoved);
+}
+
+bool putPacket(PacketQueue* queue, AVPacket* packet, int generation)
+{
+	// NULL packet marks end of input, given packet is moved into the queue,
+	// returns false if packet was dropped because seek was requested while waiting
+	lockMutex(&queue->mutex);
+	while (queue->count == queue->size && !isStale(generation))
+	{
+		waitCondVar(&queue->packetRemoved, &queue->mutex);
+	}
+
+	if (isStale(generation))
+	{
+		unlockMutex(&queue->mutex);
+		if (packet) { av_packet_unref(packet); }
+		return false;
+	}
+
+	QueuedPacket* back = &queue->packets[(queue->front + queue->count) % queue->size];
+	if (packet) { av_packet_move_ref(back->packet, packet); }
+	back->generation = generation;
+	back->end = !packet;
+
+	queue->count++;
+	wakeCondVar(&queue->packetAdded);
+	unlockMutex(&queue->mutex);
+	return true;
+}
+
+bool getPacket(PacketQueue* queue, AVPacket* packet, int* generation)
+{
+	// returns false for end of input marker
+	lockMutex(&queue->mutex);
+	while (!queue->count) { waitCondVar(&queue->packetAdded, &queue->mutex); }
+
+	QueuedPacket* front = &queue->packets[queue->front];
+	bool end = front->end;
+	if (!end) { av_packet_move_ref(packet, front->packet); }
+	*generation = front->generation;
+
+	queue->front = (queue->front + 1) % queue->size;
+	queue->count--;
+	wakeCondVar(&queue->packetRemoved);
+	unlockMutex(&queue->mutex);
+	return !end;
+}
+
+void flushPacketQueue(PacketQueue* queue)
+{
+	lockMutex(&queue->mutex);
+	for (int i = 0; i < queue->count; i++)
+	{
+		av_packet_unref(queue->packets[(queue->front + i) % queue->size].packet);
+	}
+	queue->count = 0;
+	wakeCondVar(&queue->packetRemoved);
+	unlockMutex(&queue->mutex);
+}
+
+void wakePacketQueue(PacketQueue* queue)
+{
+	// demux thread waiting for space checks seek generation after it's woken up
+	lockMutex(&queue->mutex);
+	wakeCondVar(&queue->packetRemoved);
+	unlockMutex(&queue->mutex);
+}
+
+static bool isStale(int generation)
+{
+	return generation != psnip_atomic_int32_load(&seekGeneration);
+}
\ No newline at end of file
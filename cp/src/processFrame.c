@@ -1,5 +1,17 @@
 #include "conplayer.h"
 
+typedef struct
+{
+	Frame* frame;
+	int bandCount;
+	int rowSize; // maximum size of one output row
+	uint8_t* rowColors; // NULL when colors aren't processed
+	uint32_t randSeed;
+} BandArgs;
+
+// smaller frames are processed faster than waking up helper threads
+static const int MIN_BAND_CELLS = 16384;
+
 // https://devblogs.microsoft.com/commandline/updating-the-windows-console-colors/
 static const uint8_t CMD_COLORS_16[16][3] =
 {
@@ -9,86 +21,262 @@ static const uint8_t CMD_COLORS_16[16][3] =
 	{231,72,86},{180,0,158},{249,241,165},{242,242,242}
 };
 
-static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* output, int* outputLineOffsets);
-static void processForWinAPI(Frame* frame);
-static void processForGlConsole(Frame* frame);
+// character for every brightness, with gamma and contrast already applied
+static char charsetTable[256];
+
+// rgbToAnsi256() - cube level of every channel value and gray ramp index of every gray value
+static uint8_t ansiLevels[256];
+static uint8_t ansiGrays[256];
+
+// findNearestColor16() - RGB cube with 32 cells per channel, for every cell palette colors which
+// can be the nearest to some point inside it are stored as a mask. Most cells have only one such
+// color, in others distances are compared only for colors from the mask.
+static const int NEAREST_CELL_SHIFT = 3;
+static uint16_t nearestMasks[32 * 32 * 32];
+static uint8_t nearestColors[32 * 32 * 32]; // color index or 0xFF if mask has more than one color
+
+// Shortest forms of SGR sequences, whole array is always copied and output position is moved by
+// "len", so the copy has fixed size, extra bytes are overwritten by following ones. Copied arrays
+// together with the character never exceed the cell size from getOutputArraySize() - 6 bytes
+// for 16 colors (codes are always 5 bytes long), 12 for 256 colors and 20 for RGB (7 + 4 + 4 + 4).
+typedef struct
+{
+	char str[11]; // "\x1B[38;5;255m"
+	uint8_t len;
+} SgrCode;
+
+typedef struct
+{
+	char str[4]; // channel value followed by ';' or 'm'
+	uint8_t len;
+} SgrNumber;
+
+static const char SGR_RGB_PREFIX[7] = { '\x1B', '[', '3', '8', ';', '2', ';' };
+
+static char sgrColors16[16][5];   // "\x1B[97m", indexed by CMD palette index
+static SgrCode sgrColors256[256];
+static SgrNumber sgrChannels[256];     // "255;"
+static SgrNumber sgrLastChannels[256]; // "255m"
+
+static void processBands(Frame* frame, uint32_t* randState);
+static void processBand(void* ptr, int band);
+static int bandFirstRow(BandArgs* args, int band);
+static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* output, int* outputLineOffsets, uint8_t* rowColors, uint32_t* randState);
+static void processForWinAPI(Frame* frame, uint32_t* randState);
+static void processForGlConsole(Frame* frame, uint32_t* randState);
+#ifdef _WIN32
 static uint8_t procColor(uint8_t* r, uint8_t* g, uint8_t* b);
-static void procRand(uint8_t* val);
+#endif
+static void procRand(uint8_t* val, uint32_t* randState);
+static void initColorTables(void);
+static void initSgrTables(void);
+static void setSgrCode(SgrCode* code, const char* format, int val);
+static void setSgrNumber(SgrNumber* number, int val, char terminator);
+static int channelDistance(int val, int min, int max, bool farthest);
 static uint8_t findNearestColor16(uint8_t r, uint8_t g, uint8_t b);
 static uint8_t rgbToAnsi256(uint8_t r, uint8_t g, uint8_t b);
 static void rgbFromAnsi256(uint8_t ansi, uint8_t* r, uint8_t* g, uint8_t* b);
 
-void processFrame(Frame* frame)
+void initProcessFrame(void)
+{
+	for (int i = 0; i < 256; i++)
+	{
+		// with default gamma and contrast (1.0) val is equal to i
+		double val = (((double)i / 255.0) - 0.5) * settings.contrast + 0.5;
+		val = pow(fmin(fmax(val, 0.0), 1.0), 1.0 / settings.gamma);
+
+		int brightness = (int)(val * 255.0 + 0.5);
+		charsetTable[i] = settings.charset[(brightness * settings.charsetSize) / 256];
+	}
+
+	initColorTables();
+	initSgrTables();
+}
+
+void processFrame(Frame* frame, uint32_t* randState)
 {
 	if (settings.useFakeConsole)
 	{
-		processForGlConsole(frame);
+		processForGlConsole(frame, randState);
 	}
 	else if (settings.colorMode == CM_WINAPI_GRAY ||
 		settings.colorMode == CM_WINAPI_16)
 	{
-		processForWinAPI(frame);
+		processForWinAPI(frame, randState);
+	}
+	else
+	{
+		processBands(frame, randState);
+	}
+
+}
+
+int writeCellColor(char* output, const Cell* cell)
+{
+	// same SGR sequence as written by processImage(), only its length is returned when output is NULL,
+	// up to 19 bytes can be written
+	switch (settings.colorMode)
+	{
+	case CM_CSTD_16:
+		if (output) { memcpy(output, sgrColors16[cell->r], sizeof(sgrColors16[cell->r])); }
+		return sizeof(sgrColors16[cell->r]);
+
+	case CM_CSTD_256:
+		if (output) { memcpy(output, sgrColors256[cell->r].str, sizeof(sgrColors256[cell->r].str)); }
+		return sgrColors256[cell->r].len;
+
+	case CM_CSTD_RGB:
+	{
+		int len = sizeof(SGR_RGB_PREFIX) + sgrChannels[cell->r].len + sgrChannels[cell->g].len;
+		if (output)
+		{
+			memcpy(output, SGR_RGB_PREFIX, sizeof(SGR_RGB_PREFIX));
+			memcpy(output + sizeof(SGR_RGB_PREFIX), sgrChannels[cell->r].str, sizeof(sgrChannels[cell->r].str));
+			memcpy(output + sizeof(SGR_RGB_PREFIX) + sgrChannels[cell->r].len, sgrChannels[cell->g].str, sizeof(sgrChannels[cell->g].str));
+			memcpy(output + len, sgrLastChannels[cell->b].str, sizeof(sgrLastChannels[cell->b].str));
+		}
+		return len + sgrLastChannels[cell->b].len;
+	}
+
+	default:
+		return 0;
+	}
+}
+
+static void processBands(Frame* frame, uint32_t* randState)
+{
+	uint8_t* output = (uint8_t*)frame->output;
+	int* outputLineOffsets = frame->outputLineOffsets;
+
+	BandArgs args;
+	args.frame = frame;
+	args.bandCount = cp_clamp((frame->w * frame->h) / MIN_BAND_CELLS, 1, cp_min(settings.procThreads, frame->h));
+	args.rowSize = (int)getOutputArraySize(frame->w, 1);
+	args.randSeed = cpRand(randState);
+
+	// buffer stays in the slot, so it's allocated only when frame size changes
+	args.rowColors = NULL;
+	if (settings.colorProcMode != CPM_NONE && (settings.colorMode == CM_CSTD_16 ||
+		settings.colorMode == CM_CSTD_256 || settings.colorMode == CM_CSTD_RGB))
+	{
+		frame->rowColors = (uint8_t*)poolResize(frame->rowColors, args.bandCount * frame->w * 4);
+		args.rowColors = frame->rowColors;
+	}
+
+	outputLineOffsets[0] = 0;
+	if (args.bandCount == 1)
+	{
+		processImage(frame, 0, 0, frame->w, frame->h, output, outputLineOffsets, args.rowColors, randState);
 	}
 	else
 	{
-		processImage(frame, 0, 0, frame->w, frame->h,
-			(uint8_t*)frame->output, frame->outputLineOffsets);
+		runBands(&processBand, &args, args.bandCount);
+
+		// every band was written at the position of its worst case size,
+		// so bands have to be moved together and their line offsets fixed
+		int outputPos = 0;
+		for (int i = 0; i < args.bandCount; i++)
+		{
+			int firstRow = bandFirstRow(&args, i);
+			int lastRow = bandFirstRow(&args, i + 1);
+			int bandStart = firstRow * args.rowSize;
+			int bandSize = outputLineOffsets[lastRow];
+
+			if (outputPos != bandStart) { memmove(output + outputPos, output + bandStart, bandSize); }
+			for (int j = firstRow + 1; j <= lastRow; j++) { outputLineOffsets[j] += outputPos; }
+			outputPos += bandSize;
+		}
 	}
 
+	if (!settings.disableCLS)
+	{
+		output[outputLineOffsets[frame->h] - 1] = '\0';
+		outputLineOffsets[frame->h]--;
+	}
 }
 
-static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* output, int* outputLineOffsets)
+static void processBand(void* ptr, int band)
+{
+	BandArgs* args = (BandArgs*)ptr;
+	int firstRow = bandFirstRow(args, band);
+	uint32_t randState = (args->randSeed ^ (0x9E3779B9u * (uint32_t)(band + 1))) | 1;
+
+	// line offsets of band are relative to its start, outputLineOffsets[firstRow] belongs to previous band
+	processImage(args->frame, 0, firstRow, args->frame->w, bandFirstRow(args, band + 1) - firstRow,
+		(uint8_t*)args->frame->output + (firstRow * args->rowSize),
+		args->frame->outputLineOffsets + firstRow,
+		args->rowColors ? args->rowColors + (band * args->frame->w * 4) : NULL, &randState);
+}
+
+static int bandFirstRow(BandArgs* args, int band)
+{
+	return (args->frame->h * band) / args->bandCount;
+}
+
+static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* output, int* outputLineOffsets, uint8_t* rowColors, uint32_t* randState)
 {
 	if (settings.colorMode == CM_CSTD_16 ||
 		settings.colorMode == CM_CSTD_256 ||
 		settings.colorMode == CM_CSTD_RGB)
 	{
-		outputLineOffsets[0] = 0;
 		int yPos = y;
 
+		// colors of whole row are processed at once into rowColors (w * 4 bytes), see procColors()
 		for (int i = 0; i < h; i++)
 		{
 			uint8_t oldColor = -1;
 			uint8_t oldR = -1, oldG = -1, oldB = -1;
 			int isFirstChar = 1;
 
-			int offset = outputLineOffsets[i];
+			int offset = i ? outputLineOffsets[i] : 0;
 			int xPos = x;
+			Cell* cells = frame->cells ? frame->cells + (yPos * frame->w) + x : NULL;
+
+			if (rowColors)
+			{
+				procColors(frame->videoFrame + (x * 3) + (yPos * frame->videoLinesize), rowColors,
+					rowColors + w, rowColors + (w * 2), rowColors + (w * 3), w, settings.colorProcMode == CPM_BOTH);
+			}
 
 			for (int j = 0; j < w; j++)
 			{
-				uint8_t valR = frame->videoFrame[(xPos * 3) + (yPos * frame->videoLinesize)];
-				uint8_t valG = frame->videoFrame[(xPos * 3) + (yPos * frame->videoLinesize) + 1];
-				uint8_t valB = frame->videoFrame[(xPos * 3) + (yPos * frame->videoLinesize) + 2];
+				uint8_t valR, valG, valB, val;
+				uint8_t color = 0;
 
-				uint8_t color;
-				uint8_t val = settings.colorProcMode == CPM_NONE ? 255 : procColor(&valR, &valG, &valB);
+				if (rowColors)
+				{
+					valR = rowColors[j];
+					valG = rowColors[w + j];
+					valB = rowColors[(w * 2) + j];
+					val = rowColors[(w * 3) + j];
+				}
+				else
+				{
+					valR = frame->videoFrame[(xPos * 3) + (yPos * frame->videoLinesize)];
+					valG = frame->videoFrame[(xPos * 3) + (yPos * frame->videoLinesize) + 1];
+					valB = frame->videoFrame[(xPos * 3) + (yPos * frame->videoLinesize) + 2];
+					val = 255;
+				}
 
-				if (settings.brightnessRand) { procRand(&val); }
+				if (settings.brightnessRand) { procRand(&val, randState); }
 
 				switch (settings.colorMode)
 				{
 				case CM_CSTD_16:
 					color = findNearestColor16(valR, valG, valB);
-					color = (color & 0b1010) | ((color & 4) >> 2) | ((color & 1) << 2);
-					color += color > 7 ? 82 : 30;
 
 					if (color == oldColor && !isFirstChar)
 					{
-						output[offset] = settings.charset[(val * settings.charsetSize) / 256];
+						output[offset] = charsetTable[val];
 						offset++;
 						break;
 					}
 					oldColor = color;
 
-					output[offset] = '\x1B';
-					output[offset + 1] = '[';
-					output[offset + 2] = (char)(((color / 10) % 10) + 0x30);
-					output[offset + 3] = (char)((color % 10) + 0x30);
-					output[offset + 4] = 'm';
-					output[offset + 5] = settings.charset[(val * settings.charsetSize) / 256];
-
-					offset += 6;
+					memcpy(output + offset, sgrColors16[color], sizeof(sgrColors16[color]));
+					offset += sizeof(sgrColors16[color]);
+					output[offset] = charsetTable[val];
+					offset++;
 					break;
 
 				case CM_CSTD_256:
@@ -96,32 +284,22 @@ static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* outp
 
 					if (color == oldColor && !isFirstChar)
 					{
-						output[offset] = settings.charset[(val * settings.charsetSize) / 256];
+						output[offset] = charsetTable[val];
 						offset++;
 						break;
 					}
 					oldColor = color;
 
-					output[offset] = '\x1B';
-					output[offset + 1] = '[';
-					output[offset + 2] = '3';
-					output[offset + 3] = '8';
-					output[offset + 4] = ';';
-					output[offset + 5] = '5';
-					output[offset + 6] = ';';
-					output[offset + 7] = (char)(((color / 100) % 10) + 0x30);
-					output[offset + 8] = (char)(((color / 10) % 10) + 0x30);
-					output[offset + 9] = (char)((color % 10) + 0x30);
-					output[offset + 10] = 'm';
-					output[offset + 11] = settings.charset[(val * settings.charsetSize) / 256];
-
-					offset += 12;
+					memcpy(output + offset, sgrColors256[color].str, sizeof(sgrColors256[color].str));
+					offset += sgrColors256[color].len;
+					output[offset] = charsetTable[val];
+					offset++;
 					break;
 
 				case CM_CSTD_RGB:
 					if (valR == oldR && valG == oldG && valB == oldB && !isFirstChar)
 					{
-						output[offset] = settings.charset[(val * settings.charsetSize) / 256];
+						output[offset] = charsetTable[val];
 						offset++;
 						break;
 					}
@@ -129,31 +307,28 @@ static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* outp
 					oldG = valG;
 					oldB = valB;
 
-					output[offset] = '\x1B';
-					output[offset + 1] = '[';
-					output[offset + 2] = '3';
-					output[offset + 3] = '8';
-					output[offset + 4] = ';';
-					output[offset + 5] = '2';
-					output[offset + 6] = ';';
-					output[offset + 7] = (char)(((valR / 100) % 10) + 0x30);
-					output[offset + 8] = (char)(((valR / 10) % 10) + 0x30);
-					output[offset + 9] = (char)((valR % 10) + 0x30);
-					output[offset + 10] = ';';
-					output[offset + 11] = (char)(((valG / 100) % 10) + 0x30);
-					output[offset + 12] = (char)(((valG / 10) % 10) + 0x30);
-					output[offset + 13] = (char)((valG % 10) + 0x30);
-					output[offset + 14] = ';';
-					output[offset + 15] = (char)(((valB / 100) % 10) + 0x30);
-					output[offset + 16] = (char)(((valB / 10) % 10) + 0x30);
-					output[offset + 17] = (char)((valB % 10) + 0x30);
-					output[offset + 18] = 'm';
-					output[offset + 19] = settings.charset[(val * settings.charsetSize) / 256];
-
-					offset += 20;
+					memcpy(output + offset, SGR_RGB_PREFIX, sizeof(SGR_RGB_PREFIX));
+					offset += sizeof(SGR_RGB_PREFIX);
+					memcpy(output + offset, sgrChannels[valR].str, sizeof(sgrChannels[valR].str));
+					offset += sgrChannels[valR].len;
+					memcpy(output + offset, sgrChannels[valG].str, sizeof(sgrChannels[valG].str));
+					offset += sgrChannels[valG].len;
+					memcpy(output + offset, sgrLastChannels[valB].str, sizeof(sgrLastChannels[valB].str));
+					offset += sgrLastChannels[valB].len;
+					output[offset] = charsetTable[val];
+					offset++;
 					break;
 				}
 
+				if (cells)
+				{
+					bool rgb = settings.colorMode == CM_CSTD_RGB;
+					cells[j].ch = charsetTable[val];
+					cells[j].r = rgb ? valR : color;
+					cells[j].g = rgb ? valG : 0;
+					cells[j].b = rgb ? valB : 0;
+				}
+
 				isFirstChar = 0;
 				xPos++;
 			}
@@ -162,45 +337,50 @@ static void processImage(Frame* frame, int x, int y, int w, int h, uint8_t* outp
 			outputLineOffsets[i + 1] = offset + 1;
 			yPos++;
 		}
-
-		if (!settings.disableCLS)
-		{
-			output[outputLineOffsets[h] - 1] = '\0';
-			outputLineOffsets[h]--;
-		}
 	}
 	else
 	{
 		int fullW = w + 1;
-		outputLineOffsets[0] = 0;
 		int yPos = y;
 
 		for (int i = 0; i < h; i++)
 		{
-			int xPos = x;
+			if (settings.brightnessRand)
+			{
+				int xPos = x;
 
-			for (int j = 0; j < w; j++)
+				for (int j = 0; j < w; j++)
+				{
+					uint8_t val = frame->videoFrame[(yPos * frame->videoLinesize) + xPos];
+					procRand(&val, randState);
+					output[(i * fullW) + j] = charsetTable[val];
+					xPos++;
+				}
+			}
+			else
 			{
-				uint8_t val = frame->videoFrame[(yPos * frame->videoLinesize) + xPos];
-				if (settings.brightnessRand) { procRand(&val); }
-				output[(i * fullW) + j] = settings.charset[(val * settings.charsetSize) / 256];
-				xPos++;
+				translateBytes(frame->videoFrame + (yPos * frame->videoLinesize) + x,
+					output + (i * fullW), w, (const uint8_t*)charsetTable);
+			}
+
+			if (frame->cells)
+			{
+				Cell* cells = frame->cells + (yPos * frame->w) + x;
+				for (int j = 0; j < w; j++)
+				{
+					cells[j].ch = output[(i * fullW) + j];
+					cells[j].r = cells[j].g = cells[j].b = 0;
+				}
 			}
 
 			output[(i * fullW) + w] = '\n';
 			outputLineOffsets[i + 1] = ((i + 1) * fullW);
 			yPos++;
 		}
-
-		if (!settings.disableCLS)
-		{
-			output[((h - 1) * fullW) + w] = '\0';
-			outputLineOffsets[h]--;
-		}
 	}
 }
 
-static void processForWinAPI(Frame* frame)
+static void processForWinAPI(Frame* frame, uint32_t* randState)
 {
 	#ifdef _WIN32
 
@@ -223,9 +403,9 @@ static void processForWinAPI(Frame* frame)
 				if (settings.colorProcMode == CPM_NONE) { val = 255; }
 				else { val = procColor(&valR, &valG, &valB); }
 
-				if (settings.brightnessRand) { procRand(&val); }
+				if (settings.brightnessRand) { procRand(&val, randState); }
 
-				output[(i * w) + j].Char.AsciiChar = settings.charset[(val * settings.charsetSize) / 256];
+				output[(i * w) + j].Char.AsciiChar = charsetTable[val];
 				output[(i * w) + j].Attributes = findNearestColor16(valR, valG, valB);
 			}
 		}
@@ -237,8 +417,8 @@ static void processForWinAPI(Frame* frame)
 			for (int j = 0; j < w; j++)
 			{
 				uint8_t val = frame->videoFrame[j + i * frame->videoLinesize];
-				if (settings.brightnessRand) { procRand(&val); }
-				output[(i * w) + j].Char.AsciiChar = settings.charset[(val * settings.charsetSize) / 256];
+				if (settings.brightnessRand) { procRand(&val, randState); }
+				output[(i * w) + j].Char.AsciiChar = charsetTable[val];
 				
 				if (settings.setColorMode == SCM_WINAPI)
 				{
@@ -256,7 +436,7 @@ static void processForWinAPI(Frame* frame)
 	#endif
 }
 
-static void processForGlConsole(Frame* frame)
+static void processForGlConsole(Frame* frame, uint32_t* randState)
 {
 	#ifndef CP_DISABLE_OPENGL
 	GlConsoleChar* output = (GlConsoleChar*)frame->output;
@@ -304,7 +484,7 @@ static void processForGlConsole(Frame* frame)
 				}
 			}
 
-			if (settings.brightnessRand) { procRand(&val); }
+			if (settings.brightnessRand) { procRand(&val, randState); }
 
 			//double pos = ((double)val / 255.0) * (settings.charsetSize - 1);
 			//double dec = pos - floor(pos);
@@ -316,7 +496,7 @@ static void processForGlConsole(Frame* frame)
 			//if (charPos >= settings.charsetSize) { error("vsddsfsfd", "fdfds", 0); }
 			//output[(i * w) + j].ch = settings.charset[charPos];
 
-			output[(i * w) + j].ch = settings.charset[(val * settings.charsetSize) / 256];
+			output[(i * w) + j].ch = charsetTable[val];
 			output[(i * w) + j].r = valR;
 			output[(i * w) + j].g = valG;
 			output[(i * w) + j].b = valB;
@@ -325,64 +505,158 @@ static void processForGlConsole(Frame* frame)
 	#endif
 }
 
+#ifdef _WIN32 // WinAPI and OpenGL outputs, OpenGL is also Windows only
 static uint8_t procColor(uint8_t* r, uint8_t* g, uint8_t* b)
 {
-	uint8_t valR = *r, valG = *g, valB = *b;
-
-	if (settings.colorProcMode == CPM_BOTH)
-	{
-		if (valR >= valG && valR >= valB)
-		{
-			*r = 255;
-			*g = (uint8_t)(255.0f * ((float)valG / (float)valR));
-			*b = (uint8_t)(255.0f * ((float)valB / (float)valR));
-		}
-		else if (valG >= valR && valG >= valB)
-		{
-			*r = (uint8_t)(255.0f * ((float)valR / (float)valG));
-			*g = 255;
-			*b = (uint8_t)(255.0f * ((float)valB / (float)valG));
-		}
-		else
-		{
-			*r = (uint8_t)(255.0f * ((float)valR / (float)valB));
-			*g = (uint8_t)(255.0f * ((float)valG / (float)valB));
-			*b = 255;
-		}
-	}
+	// single pixel version of procColors(), for outputs that aren't processed by rows
+	uint8_t rgb[3] = { *r, *g, *b };
+	uint8_t luma;
 
-	return (uint8_t)((double)valR * 0.299 + (double)valG * 0.587 + (double)valB * 0.114);
+	procColors(rgb, r, g, b, &luma, 1, settings.colorProcMode == CPM_BOTH);
+	return luma;
 }
+#endif
 
-static void procRand(uint8_t* val)
+static void procRand(uint8_t* val, uint32_t* randState)
 {
 	if (settings.colorProcMode == CPM_NONE)
 	{
-		*val -= rand() % (settings.brightnessRand + 1);
+		*val -= (int)(cpRand(randState) % (uint32_t)(settings.brightnessRand + 1));
 	}
 	else
 	{
 		if (settings.brightnessRand > 0)
 		{
 			int newVal = (int)(*val) +
-				(rand() % (settings.brightnessRand + 1)) -
+				((int)(cpRand(randState) % (uint32_t)(settings.brightnessRand + 1))) -
 				(settings.brightnessRand / 2);
 			*val = (uint8_t)cp_clamp(newVal, 0, 255);
 		}
 		else
 		{
-			int newVal = (int)(*val) - (rand() % (-settings.brightnessRand + 1));
+			int newVal = (int)(*val) - ((int)(cpRand(randState) % (uint32_t)(-settings.brightnessRand + 1)));
 			*val = (uint8_t)cp_max(newVal, 0);
 		}
 	}
 }
 
+static void initColorTables(void)
+{
+	// same expressions as before tables were used, so results are identical
+	// https://stackoverflow.com/a/26665998
+	for (int i = 0; i < 256; i++)
+	{
+		ansiLevels[i] = (uint8_t)round((double)i / 51.0); // 51 = 255/5
+
+		if (i < 8) { ansiGrays[i] = 16; }
+		else if (i > 248) { ansiGrays[i] = 231; }
+		else { ansiGrays[i] = (uint8_t)round((((double)i - 8.0) / 247.0) * 24.0) + 232; }
+	}
+
+	const int cellSize = 1 << NEAREST_CELL_SHIFT;
+	for (int cell = 0; cell < 32 * 32 * 32; cell++)
+	{
+		int cellMin[3] = {
+			((cell >> 10) & 31) << NEAREST_CELL_SHIFT,
+			((cell >> 5) & 31) << NEAREST_CELL_SHIFT,
+			(cell & 31) << NEAREST_CELL_SHIFT };
+
+		// color can be the nearest only if the closest point of the cell isn't farther than
+		// the farthest point of the cell is from some other color
+		int nearDist[16];
+		int bestFarDist = INT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			int farDist = 0;
+			nearDist[i] = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				nearDist[i] += channelDistance(CMD_COLORS_16[i][c], cellMin[c], cellMin[c] + cellSize - 1, false);
+				farDist += channelDistance(CMD_COLORS_16[i][c], cellMin[c], cellMin[c] + cellSize - 1, true);
+			}
+			if (farDist < bestFarDist) { bestFarDist = farDist; }
+		}
+
+		uint16_t mask = 0;
+		int count = 0, lastColor = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			if (nearDist[i] <= bestFarDist)
+			{
+				mask |= (uint16_t)(1 << i);
+				lastColor = i;
+				count++;
+			}
+		}
+
+		nearestMasks[cell] = mask;
+		nearestColors[cell] = count == 1 ? (uint8_t)lastColor : 0xFF;
+	}
+}
+
+static void initSgrTables(void)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		// CMD palette has red and blue swapped compared to ANSI, bright colors are 90-97
+		int color = (i & 0b1010) | ((i & 4) >> 2) | ((i & 1) << 2);
+		char str[8];
+		snprintf(str, sizeof(str), "\x1B[%dm", color > 7 ? color + 82 : color + 30);
+		memcpy(sgrColors16[i], str, sizeof(sgrColors16[i]));
+	}
+
+	for (int i = 0; i < 256; i++)
+	{
+		setSgrCode(&sgrColors256[i], "\x1B[38;5;%dm", i);
+		setSgrNumber(&sgrChannels[i], i, ';');
+		setSgrNumber(&sgrLastChannels[i], i, 'm');
+	}
+}
+
+static void setSgrCode(SgrCode* code, const char* format, int val)
+{
+	char str[16];
+	int len = snprintf(str, sizeof(str), format, val);
+
+	memset(code->str, 0, sizeof(code->str));
+	memcpy(code->str, str, len);
+	code->len = (uint8_t)len;
+}
+
+static void setSgrNumber(SgrNumber* number, int val, char terminator)
+{
+	char str[8];
+	int len = snprintf(str, sizeof(str), "%d%c", val, terminator);
+
+	memset(number->str, 0, sizeof(number->str));
+	memcpy(number->str, str, len);
+	number->len = (uint8_t)len;
+}
+
+static int channelDistance(int val, int min, int max, bool farthest)
+{
+	// squared distance from val to the nearest or the farthest value in [min, max]
+	int diff;
+	if (farthest) { diff = cp_max(val - min, max - val); }
+	else if (val < min) { diff = min - val; }
+	else if (val > max) { diff = val - max; }
+	else { diff = 0; }
+	return diff * diff;
+}
+
 static uint8_t findNearestColor16(uint8_t r, uint8_t g, uint8_t b)
 {
+	int cell = ((r >> NEAREST_CELL_SHIFT) << 10) | ((g >> NEAREST_CELL_SHIFT) << 5) | (b >> NEAREST_CELL_SHIFT);
+	if (nearestColors[cell] != 0xFF) { return nearestColors[cell]; }
+
+	// colors are checked in palette order, so ties are resolved the same way as without the mask
+	uint16_t mask = nearestMasks[cell];
 	int min = INT_MAX;
 	int minPos = 0;
-	for (int i = 0; i < 16; i++)
+	for (int i = 0; mask; i++, mask >>= 1)
 	{
+		if (!(mask & 1)) { continue; }
+
 		int diff = (r - CMD_COLORS_16[i][0]) * (r - CMD_COLORS_16[i][0]) +
 			(g - CMD_COLORS_16[i][1]) * (g - CMD_COLORS_16[i][1]) +
 			(b - CMD_COLORS_16[i][2]) * (b - CMD_COLORS_16[i][2]);
@@ -397,18 +671,8 @@ static uint8_t findNearestColor16(uint8_t r, uint8_t g, uint8_t b)
 
 static uint8_t rgbToAnsi256(uint8_t r, uint8_t g, uint8_t b)
 {
-	// https://stackoverflow.com/a/26665998
-	if (r == g && g == b)
-	{
-		if (r < 8) { return 16; }
-		if (r > 248) { return 231; }
-		return (uint8_t)round((((double)r - 8.0) / 247.0) * 24.0) + 232;
-	}
-
-	return (uint8_t)(16.0
-		+ (36.0 * round((double)r / 51.0))  // 51 = 255/5
-		+ (6.0 * round((double)g / 51.0))
-		+ round((double)b / 51.0));
+	if (r == g && g == b) { return ansiGrays[r]; }
+	return (uint8_t)(16 + 36 * ansiLevels[r] + 6 * ansiLevels[g] + ansiLevels[b]);
 }
 
 static void rgbFromAnsi256(uint8_t ansi, uint8_t* r, uint8_t* g, uint8_t* b)
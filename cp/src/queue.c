@@ -1,126 +1,339 @@
 #include "conplayer.h"
 
+#ifdef _MSC_VER
+#define CP_CACHE_ALIGNED __declspec(align(CP_CACHE_LINE_SIZE))
+#else
+#define CP_CACHE_ALIGNED __attribute__((aligned(CP_CACHE_LINE_SIZE)))
+#endif
+
+// Main thread loads every frame into lowest free slot and remembers it in sequenceSlots, so only
+// first "depth" slots are used and slots above it can give their buffers back. Loading and drawing
+// cursors are owned by a single thread (main and drawThread), processing cursor is shared by all
+// processing threads. Every cursor is kept on its own cache line to avoid false sharing.
+// "waiters" counts threads blocked waiting for a slot to reach the stage consumed with this cursor.
+typedef struct
+{
+	CP_CACHE_ALIGNED psnip_atomic_int64 sequence;
+	psnip_atomic_int32 waiters;
+} QueueCursor;
+
 typedef struct
 {
-	int drawingPos, processingPos, loadingPos;
-	int size;
+	QueueCursor loading, processing, drawing;
+	CP_CACHE_ALIGNED psnip_atomic_int64 loaded; // number of frames passed to processing
+	CP_CACHE_ALIGNED psnip_atomic_int64 freed;  // number of frames drawn and freed
+	psnip_atomic_int32 depth; // how many frames can be in the queue at once (<= size)
+	CP_CACHE_ALIGNED int size;
 	Frame* array;
+	int* sequenceSlots;  // slot of every frame in the queue, indexed by sequence % size
+	bool* slotAllocated; // slot has video buffers
+	psnip_atomic_int32 allocatedSlots;
+	int steadyFrames;
+	Mutex mutex;
+	CondVar stageReached[3]; // indexed by Stage
+	int lastGeneration;      // seek generation of last drawn frame
 } Queue;
 
-static const int TIME_TO_WAIT = 16;
-static volatile Queue queue;
+static const int STEADY_FRAMES_TO_SHRINK = 256;
+static Queue queue;
 
-static Frame* queueNextElement(int currentPos);
+static QueueCursor* consumerCursor(Stage stage);
+static bool slotReached(Frame** frame, Stage stage, int64_t sequence);
+static Frame* takeFreeSlot(int64_t sequence);
+static void wakeAll(void);
+static void freeSlotBuffers(Frame* frame);
+static void updateDepth(Frame* drawnFrame, bool underrun);
+static void setDepth(int depth);
 
 void initQueue(void)
 {
 	static bool queueExists = false;
 
-	if (queueExists)
+	if (!queueExists)
 	{
-		for (int i = 0; i < QUEUE_SIZE; i++)
+		// slots are allocated for maximum depth, but buffers only for slots in use
+		queue.size = settings.queueMaxDepth;
+		queue.array = (Frame*)malloc(queue.size * sizeof(Frame));
+		queue.sequenceSlots = (int*)calloc(queue.size, sizeof(int));
+		queue.slotAllocated = (bool*)calloc(queue.size, sizeof(bool));
+		queue.steadyFrames = 0;
+		psnip_atomic_int32_store(&queue.allocatedSlots, 0);
+		setDepth(settings.queueMinDepth);
+
+		initMutex(&queue.mutex);
+		for (int i = 0; i < 3; i++) { initCondVar(&queue.stageReached[i]); }
+		queue.lastGeneration = 0;
+
+		for (int i = 0; i < queue.size; i++)
 		{
-			if (queue.array[i].videoFrame) { free(queue.array[i].videoFrame); }
-			if (queue.array[i].audioFrame) { av_free(queue.array[i].audioFrame); }
-			if (queue.array[i].output) { free(queue.array[i].output); }
+			queue.array[i].w = -1;
+			queue.array[i].h = -1;
+
+			queue.array[i].videoFrame = NULL;
+			queue.array[i].videoLinesize = 0;
+
+			queue.array[i].output = NULL;
+			queue.array[i].outputLineOffsets = NULL;
+			queue.array[i].cells = NULL;
+			queue.array[i].rowColors = NULL;
 		}
 	}
-	else
-	{
-		queue.size = QUEUE_SIZE;
-		queue.array = (Frame*)malloc(QUEUE_SIZE * sizeof(Frame));
-	}
 
-	queue.drawingPos = 0;
-	queue.processingPos = 0;
-	queue.loadingPos = 0;
+	psnip_atomic_int64_store(&queue.loading.sequence, 0);
+	psnip_atomic_int64_store(&queue.processing.sequence, 0);
+	psnip_atomic_int64_store(&queue.drawing.sequence, 0);
+	psnip_atomic_int64_store(&queue.loaded, 0);
+	psnip_atomic_int64_store(&queue.freed, 0);
 
-	for (int i = 0; i < QUEUE_SIZE; i++)
+	for (int i = 0; i < queue.size; i++)
 	{
-		queue.array[i].stage = STAGE_FREE;
-		queue.array[i].isAudio = false;
+		psnip_atomic_int32_store(&queue.array[i].stage, STAGE_FREE);
 		queue.array[i].time = 0;
-
-		queue.array[i].w = -1;
-		queue.array[i].h = -1;
-
-		queue.array[i].videoFrame = NULL;
-		queue.array[i].videoLinesize = 0;
-
-		queue.array[i].output = NULL;
-		queue.array[i].outputLineOffsets = NULL;
-
-		queue.array[i].audioFrame = NULL;
-		queue.array[i].audioFrameSize = -1;
-		queue.array[i].audioSamplesNum = 0;
+		queue.array[i].generation = 0;
+		queue.array[i].late = false;
 	}
 
 	queueExists = true;
 }
 
-Frame* dequeueFrame(Stage fromStage, volatile bool* threadFreezedFlag)
+Frame* dequeueFrame(Stage fromStage)
 {
-	volatile int* pos;
-	if (fromStage == STAGE_LOADED_FRAME) { pos = &queue.processingPos; }
-	else if (fromStage == STAGE_PROCESSED_FRAME) { pos = &queue.drawingPos; }
-	else { pos = &queue.loadingPos; }
+	QueueCursor* cursor = consumerCursor(fromStage);
+	int64_t sequence = CP_ATOMIC_FETCH_ADD64(&cursor->sequence, 1);
+	Frame* nextFrame = NULL;
+
+	// fast path - slot already published
+	if (slotReached(&nextFrame, fromStage, sequence))
+	{
+		if (fromStage == STAGE_PROCESSED_FRAME) { updateDepth(nextFrame, false); }
+		return nextFrame;
+	}
+
+	lockMutex(&queue.mutex);
+	psnip_atomic_int32_add(&cursor->waiters, 1);
+	psnip_atomic_fence();
 
-	Frame* nextFrame = queueNextElement(*pos);
+	// draw thread waiting for a frame in the middle of playback means queue was too shallow
+	bool underrun = fromStage == STAGE_PROCESSED_FRAME && sequence > 0 && !decodeEnd;
 
-	while (nextFrame->stage != fromStage)
+	while (!slotReached(&nextFrame, fromStage, sequence))
 	{
 		if (decodeEnd && fromStage == STAGE_PROCESSED_FRAME &&
-			(nextFrame->stage == STAGE_FREE || freezeThreads))
+			CP_ATOMIC_LOAD_ACQUIRE64(&queue.loaded) <= sequence)
 		{
+			unlockMutex(&queue.mutex);
 			cpExit(0);
 		}
 
-		if (freezeThreads && threadFreezedFlag)
+		waitCondVar(&queue.stageReached[fromStage], &queue.mutex);
+	}
+
+	psnip_atomic_int32_sub(&cursor->waiters, 1);
+	if (fromStage == STAGE_PROCESSED_FRAME) { updateDepth(nextFrame, underrun); }
+	unlockMutex(&queue.mutex);
+	return nextFrame;
+}
+
+void enqueueFrame(Frame* frame, Stage toStage)
+{
+	int slot = (int)(frame - queue.array);
+
+	if (toStage == STAGE_LOADED_FRAME && frame->output && !queue.slotAllocated[slot])
+	{
+		queue.slotAllocated[slot] = true;
+		psnip_atomic_int32_add(&queue.allocatedSlots, 1);
+	}
+
+	// publishes everything written to the slot before, pairs with acquire in slotReached()
+	CP_ATOMIC_STORE_RELEASE(&frame->stage, toStage);
+	if (toStage == STAGE_LOADED_FRAME)
+	{
+		CP_ATOMIC_STORE_RELEASE64(&queue.loaded, psnip_atomic_int64_load(&queue.loaded) + 1);
+	}
+	else if (toStage == STAGE_FREE)
+	{
+		CP_ATOMIC_STORE_RELEASE64(&queue.freed, psnip_atomic_int64_load(&queue.freed) + 1);
+	}
+
+	// waiter registers itself before checking the slot and we check for waiters after
+	// publishing it, so at least one side sees the other and no wakeup is lost
+	psnip_atomic_fence();
+	if (psnip_atomic_int32_load(&consumerCursor(toStage)->waiters))
+	{
+		lockMutex(&queue.mutex);
+		wakeCondVar(&queue.stageReached[toStage]);
+		unlockMutex(&queue.mutex);
+	}
+}
+
+void setDecodeEnd(bool value, int generation)
+{
+	// end of seek generation that was already replaced by a newer one is ignored,
+	// avSeek() clears the flag with queue mutex locked after changing generation
+	lockMutex(&queue.mutex);
+	if (!value || generation == psnip_atomic_int32_load(&seekGeneration))
+	{
+		decodeEnd = value;
+		wakeAll();
+	}
+	unlockMutex(&queue.mutex);
+}
+
+int getQueueFill(void)
+{
+	// frames loaded and not drawn yet
+	return (int)(psnip_atomic_int64_load(&queue.loaded) - psnip_atomic_int64_load(&queue.freed));
+}
+
+static QueueCursor* consumerCursor(Stage stage)
+{
+	if (stage == STAGE_LOADED_FRAME) { return &queue.processing; }
+	else if (stage == STAGE_PROCESSED_FRAME) { return &queue.drawing; }
+	else { return &queue.loading; }
+}
+
+static bool slotReached(Frame** frame, Stage stage, int64_t sequence)
+{
+	// frame can be loaded only if there are less than "depth" frames in the queue,
+	// depth is never bigger than size, so one of first "depth" slots is always free
+	if (stage == STAGE_FREE)
+	{
+		if (CP_ATOMIC_LOAD_ACQUIRE64(&queue.freed) + psnip_atomic_int32_load(&queue.depth) <= sequence) { return false; }
+
+		*frame = takeFreeSlot(sequence);
+		return true;
+	}
+
+	// slot of the frame is known only after it was loaded, it can't be taken by another
+	// frame before this one is drawn (that needs "size" newer frames to be loaded)
+	if (CP_ATOMIC_LOAD_ACQUIRE64(&queue.loaded) <= sequence) { return false; }
+	*frame = &queue.array[queue.sequenceSlots[sequence % queue.size]];
+
+	// with multiple processing threads loaded frames are recognized by the counter,
+	// because frames can be processed out of order
+	if (stage == STAGE_LOADED_FRAME) { return true; }
+	return (Stage)CP_ATOMIC_LOAD_ACQUIRE(&(*frame)->stage) == stage;
+}
+
+static Frame* takeFreeSlot(int64_t sequence)
+{
+	// called only by main thread, other threads never take slots out of STAGE_FREE,
+	// lowest slot is preferred so slots above current depth stay empty
+	Frame* frame = NULL;
+	int depth = psnip_atomic_int32_load(&queue.depth);
+
+	for (int i = 0; i < queue.size; i++)
+	{
+		if (CP_ATOMIC_LOAD_ACQUIRE(&queue.array[i].stage) != STAGE_FREE) { continue; }
+
+		if (!frame)
 		{
-			while (freezeThreads)
-			{
-				*threadFreezedFlag = true;
-
-				#ifndef CP_DISABLE_OPENGL
-				if (settings.useFakeConsole && threadFreezedFlag == &mainFreezed)
-				{
-					peekMainMessages();
-				}
-				#endif
-
-				Sleep(SLEEP_ON_FREEZE);
-			}
-			return dequeueFrame(fromStage, threadFreezedFlag);
+			// published to other threads by release of "loaded" in enqueueFrame()
+			queue.sequenceSlots[sequence % queue.size] = i;
+			frame = &queue.array[i];
 		}
-
-		#ifndef CP_DISABLE_OPENGL
-		if (settings.useFakeConsole && threadFreezedFlag == &mainFreezed)
+		else if (i >= depth && queue.slotAllocated[i])
 		{
-			peekMainMessages();
+			// queue was shrunk and this slot won't be taken until it grows again, give memory back
+			freeSlotBuffers(&queue.array[i]);
 		}
-		#endif
-		Sleep(TIME_TO_WAIT);
 	}
 
-	return nextFrame;
+	if (!frame) { error("No free slot in frame queue!", "queue.c", __LINE__); }
+	return frame;
 }
 
-void enqueueFrame(Stage toStage)
+static void wakeAll(void)
 {
-	volatile int* pos;
-	if (toStage == STAGE_LOADED_FRAME) { pos = &queue.loadingPos; }
-	else if (toStage == STAGE_PROCESSED_FRAME) { pos = &queue.processingPos; }
-	else { pos = &queue.drawingPos; }
+	for (int i = 0; i < 3; i++) { wakeCondVar(&queue.stageReached[i]); }
+}
 
-	Frame* nextFrame = queueNextElement(*pos);
+static void freeSlotBuffers(Frame* frame)
+{
+	int slot = (int)(frame - queue.array);
+
+	poolFree(frame->videoFrame);
+	poolFree(frame->output);
+	poolFree(frame->outputLineOffsets);
+	poolFree(frame->cells);
+	poolFree(frame->rowColors);
+
+	frame->videoFrame = NULL;
+	frame->output = NULL;
+	frame->outputLineOffsets = NULL;
+	frame->cells = NULL;
+	frame->rowColors = NULL;
+	frame->videoLinesize = 0;
+	frame->w = -1;
+	frame->h = -1;
 
-	nextFrame->stage = toStage;
-	(*pos)++;
-	if (*pos == queue.size) { *pos = 0; }
+	if (queue.slotAllocated[slot])
+	{
+		queue.slotAllocated[slot] = false;
+		psnip_atomic_int32_sub(&queue.allocatedSlots, 1);
+	}
 }
 
-static Frame* queueNextElement(int currentPos)
+static void updateDepth(Frame* drawnFrame, bool underrun)
 {
-	if (currentPos + 1 == queue.size) { return &queue.array[0]; }
-	else { return &queue.array[currentPos + 1]; }
+	// called only by draw thread, with queue.mutex locked when underrun is true
+	int depth = psnip_atomic_int32_load(&queue.depth);
+	int occupancy = (int)(psnip_atomic_int64_load(&queue.loaded) -
+		psnip_atomic_int64_load(&queue.drawing.sequence)) + 1;
+
+	stats.queueOccupancySum += occupancy;
+	stats.queueOccupancySamples++;
+	if (occupancy > stats.queueMaxOccupancy) { stats.queueMaxOccupancy = occupancy; }
+	stats.queueAllocatedSlots = psnip_atomic_int32_load(&queue.allocatedSlots);
+
+	int maxDepth = settings.queueMaxDepth;
+	if (drawnFrame->output)
+	{
+		stats.queueSlotSize = getOutputArraySize(drawnFrame->w, drawnFrame->h) +
+			(drawnFrame->videoLinesize * drawnFrame->h) + ((drawnFrame->h + 1) * sizeof(int));
+		if (drawnFrame->cells) { stats.queueSlotSize += drawnFrame->w * drawnFrame->h * sizeof(Cell); }
+
+		if (settings.queueMem)
+		{
+			// minimum depth has priority over memory budget
+			int64_t budgetDepth = ((int64_t)settings.queueMem * 1024 * 1024) / stats.queueSlotSize;
+			if (budgetDepth < maxDepth) { maxDepth = cp_max((int)budgetDepth, settings.queueMinDepth); }
+		}
+	}
+
+	// waiting for first frame after seek isn't caused by queue depth
+	if (drawnFrame->generation != queue.lastGeneration)
+	{
+		queue.lastGeneration = drawnFrame->generation;
+		underrun = false;
+	}
+
+	if (underrun)
+	{
+		stats.queueUnderruns++;
+		queue.steadyFrames = 0;
+		depth += cp_max(depth / 4, 1);
+	}
+	else if (++queue.steadyFrames >= STEADY_FRAMES_TO_SHRINK)
+	{
+		queue.steadyFrames = 0;
+		depth--;
+	}
+
+	depth = cp_clamp(depth, settings.queueMinDepth, maxDepth);
+	if (depth != psnip_atomic_int32_load(&queue.depth))
+	{
+		// main thread can be waiting for a free slot
+		if (depth > psnip_atomic_int32_load(&queue.depth)) { wakeCondVar(&queue.stageReached[STAGE_FREE]); }
+		setDepth(depth);
+	}
+}
+
+static void setDepth(int depth)
+{
+	psnip_atomic_int32_store(&queue.depth, depth);
+
+	stats.queueDepth = depth;
+	if (depth < stats.queueMinDepthSeen) { stats.queueMinDepthSeen = depth; }
+	if (depth > stats.queueMaxDepthSeen) { stats.queueMaxDepthSeen = depth; }
 }
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "conplayer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CP_SCALING_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define CP_SCALING_NEON
+#include <arm_neon.h>
+#endif
+
+// Area scaling straight from decoded planes into the queue slot - every source pixel belongs to
+// exactly one cell, rows of a cell are first summed per column (vectorized), then columns of every
+// cell are summed and divided by cell area. It's equivalent to SWS_AREA, but without creating
+// swscale context. Gray color modes use only luma plane, color modes average luma and chroma
+// of a cell and convert it to RGB once per cell instead of once per source pixel.
+
+// source pixels covered by every cell (end is exclusive)
+typedef struct
+{
+	int* columnStart;
+	int* columnEnd;
+	int* rowStart;
+	int* rowEnd;
+	double* columnWeight; // 1 / cell width
+	double* rowWeight;    // 1 / cell height
+} CellBounds;
+
+// BT.601 coefficients, same as swscale uses by default
+typedef struct
+{
+	double y, rv, gu, gv, bu;
+	double yOffset;
+} YuvCoefficients;
+
+static const YuvCoefficients YUV_LIMITED_RANGE = { 255.0 / 219.0, 1.596027, 0.391762, 0.812968, 2.017232, 16.0 };
+static const YuvCoefficients YUV_FULL_RANGE = { 1.0, 1.402, 0.344136, 0.714136, 1.772, 0.0 };
+
+// Scaling contexts cache - creating swscale context is expensive (filter coefficients and code are
+// generated for every geometry), so contexts are kept and reused when size or format comes back,
+// e.g. after resizing console or when stream switches resolution. Least recently used is replaced.
+// Entry returned by getSwsContext() belongs to the caller until it's given back with
+// releaseSwsContext(), so context and buffer used by current frames are never replaced or shared.
+typedef struct
+{
+	int srcW, srcH, dstW, dstH, flags;
+	enum AVPixelFormat srcFormat, dstFormat;
+	struct SwsContext* context;
+	uint8_t* buffer; // destination image, allocated when needed
+	int64_t lastUse;
+	bool inUse;
+} SwsCacheEntry;
+
+#define SWS_CACHE_SIZE 8
+
+// sums of up to 257 rows of 8-bit values fit in uint16_t
+static const int MAX_SUMMED_ROWS = 257;
+
+static SwsCacheEntry swsCache[SWS_CACHE_SIZE];
+static int64_t swsCacheUses = 0;
+
+static int lastSrcW = -1, lastSrcH = -1;
+static int lastDstW = -1, lastDstH = -1;
+static int lastChromaW = -1, lastChromaH = -1;
+static CellBounds lumaBounds = { NULL, NULL, NULL, NULL, NULL, NULL };
+static CellBounds chromaBounds = { NULL, NULL, NULL, NULL, NULL, NULL };
+static uint16_t* columnSums = NULL;
+static size_t columnSumsSize = 0;
+static uint32_t* cellSums[3] = { NULL, NULL, NULL }; // Y, U, V
+static uint8_t rangeTable[256];  // limited (MPEG) range to full range, like swscale does for GRAY8
+static bool rangeTableReady = false;
+
+static SwsCacheEntry* findSwsCacheEntry(int srcW, int srcH, enum AVPixelFormat srcFormat,
+	int dstW, int dstH, enum AVPixelFormat dstFormat, int flags);
+static bool getChromaShift(int format, int* shiftW, int* shiftH, bool* interleaved);
+static void refreshBounds(int srcW, int srcH, int dstW, int dstH, int chromaShiftW, int chromaShiftH);
+static void allocBounds(CellBounds* bounds, int dstW, int dstH);
+static uint32_t cellArea(CellBounds* bounds, int x, int y);
+static void sumCells(const uint8_t* plane, int linesize, int width, int components,
+	CellBounds* bounds, int y, int dstW, uint32_t** out);
+static void sumRows(const uint8_t* src, int linesize, int rows, int size);
+static uint8_t clampColor(double val);
+static bool isFullRange(const AVFrame* frame);
+
+bool canScaleLuma(const AVFrame* frame, int dstW, int dstH)
+{
+	int shiftW, shiftH;
+	bool interleaved;
+
+	// only downscaling, area filter doesn't interpolate
+	if (dstW > frame->width || dstH > frame->height) { return false; }
+	return frame->format == AV_PIX_FMT_GRAY8 || getChromaShift(frame->format, &shiftW, &shiftH, &interleaved);
+}
+
+bool canScaleYuv(const AVFrame* frame, int dstW, int dstH)
+{
+	int shiftW, shiftH;
+	bool interleaved;
+
+	if (dstW > frame->width || dstH > frame->height) { return false; }
+	return getChromaShift(frame->format, &shiftW, &shiftH, &interleaved);
+}
+
+void scaleLuma(const AVFrame* frame, uint8_t* dst, int dstLinesize, int dstW, int dstH)
+{
+	refreshBounds(frame->width, frame->height, dstW, dstH, 0, 0);
+
+	bool expandRange = !isFullRange(frame);
+	if (expandRange && !rangeTableReady)
+	{
+		for (int i = 0; i < 256; i++) { rangeTable[i] = (uint8_t)cp_clamp(((i - 16) * 255 + 109) / 219, 0, 255); }
+		rangeTableReady = true;
+	}
+
+	for (int y = 0; y < dstH; y++)
+	{
+		sumCells(frame->data[0], frame->linesize[0], frame->width, 1, &lumaBounds, y, dstW, cellSums);
+
+		uint8_t* dstLine = dst + y * dstLinesize;
+		for (int x = 0; x < dstW; x++)
+		{
+			uint32_t area = cellArea(&lumaBounds, x, y);
+			uint8_t val = (uint8_t)((cellSums[0][x] + area / 2) / area);
+			dstLine[x] = expandRange ? rangeTable[val] : val;
+		}
+	}
+}
+
+void scaleYuvToRgb(const AVFrame* frame, uint8_t* dst, int dstLinesize, int dstW, int dstH)
+{
+	int shiftW, shiftH;
+	bool interleaved;
+	getChromaShift(frame->format, &shiftW, &shiftH, &interleaved);
+
+	int chromaW = -((-frame->width) >> shiftW);
+	refreshBounds(frame->width, frame->height, dstW, dstH, shiftW, shiftH);
+
+	const YuvCoefficients* coef = isFullRange(frame) ? &YUV_FULL_RANGE : &YUV_LIMITED_RANGE;
+	bool swapUV = frame->format == AV_PIX_FMT_NV21;
+
+	for (int y = 0; y < dstH; y++)
+	{
+		sumCells(frame->data[0], frame->linesize[0], frame->width, 1, &lumaBounds, y, dstW, cellSums);
+		if (interleaved)
+		{
+			sumCells(frame->data[1], frame->linesize[1], chromaW, 2, &chromaBounds, y, dstW, cellSums + 1);
+		}
+		else
+		{
+			sumCells(frame->data[1], frame->linesize[1], chromaW, 1, &chromaBounds, y, dstW, cellSums + 1);
+			sumCells(frame->data[2], frame->linesize[2], chromaW, 1, &chromaBounds, y, dstW, cellSums + 2);
+		}
+
+		uint8_t* dstLine = dst + y * dstLinesize;
+		for (int x = 0; x < dstW; x++)
+		{
+			// averaging and conversion are both linear, so they can be done in any order
+			double weight = lumaBounds.columnWeight[x] * lumaBounds.rowWeight[y];
+			double chromaWeight = chromaBounds.columnWeight[x] * chromaBounds.rowWeight[y];
+
+			double valY = ((double)cellSums[0][x] * weight - coef->yOffset) * coef->y + 0.5;
+			double valU = (double)cellSums[1][x] * chromaWeight - 128.0;
+			double valV = (double)cellSums[2][x] * chromaWeight - 128.0;
+			if (swapUV) { double temp = valU; valU = valV; valV = temp; }
+
+			dstLine[x * 3] = clampColor(valY + coef->rv * valV);
+			dstLine[x * 3 + 1] = clampColor(valY - coef->gu * valU - coef->gv * valV);
+			dstLine[x * 3 + 2] = clampColor(valY + coef->bu * valU);
+		}
+	}
+}
+
+struct SwsContext* getSwsContext(int srcW, int srcH, enum AVPixelFormat srcFormat,
+	int dstW, int dstH, enum AVPixelFormat dstFormat, int flags, uint8_t** buffer)
+{
+	SwsCacheEntry* entry = findSwsCacheEntry(srcW, srcH, srcFormat, dstW, dstH, dstFormat, flags);
+	entry->lastUse = ++swsCacheUses;
+	entry->inUse = true;
+
+	if (!entry->context)
+	{
+		entry->context = sws_getContext(srcW, srcH, srcFormat, dstW, dstH, dstFormat, flags, NULL, NULL, NULL);
+		if (!entry->context) { error("Failed to create scaling context!", "scaling.c", __LINE__); }
+		stats.swsContextsCreated++;
+	}
+	else
+	{
+		stats.swsCacheHits++;
+	}
+
+	if (buffer)
+	{
+		if (!entry->buffer)
+		{
+			entry->buffer = av_malloc(av_image_get_buffer_size(dstFormat, dstW, dstH, 1) * sizeof(uint8_t));
+			if (!entry->buffer) { error("Failed to allocate memory!", "scaling.c", __LINE__); }
+		}
+		*buffer = entry->buffer;
+	}
+
+	return entry->context;
+}
+
+void releaseSwsContext(struct SwsContext* context)
+{
+	// context stays in cache and can be returned again by getSwsContext()
+	if (!context) { return; }
+
+	for (int i = 0; i < SWS_CACHE_SIZE; i++)
+	{
+		if (swsCache[i].context == context) { swsCache[i].inUse = false; }
+	}
+}
+
+static SwsCacheEntry* findSwsCacheEntry(int srcW, int srcH, enum AVPixelFormat srcFormat,
+	int dstW, int dstH, enum AVPixelFormat dstFormat, int flags)
+{
+	SwsCacheEntry* oldest = NULL;
+
+	for (int i = 0; i < SWS_CACHE_SIZE; i++)
+	{
+		SwsCacheEntry* entry = &swsCache[i];
+		if (entry->inUse) { continue; }
+
+		if (entry->context && entry->srcW == srcW && entry->srcH == srcH && entry->srcFormat == srcFormat &&
+			entry->dstW == dstW && entry->dstH == dstH && entry->dstFormat == dstFormat && entry->flags == flags)
+		{
+			return entry;
+		}
+
+		// empty entries have lastUse equal to 0
+		if (!oldest || entry->lastUse < oldest->lastUse) { oldest = entry; }
+	}
+
+	if (!oldest) { error("All scaling contexts are in use!", "scaling.c", __LINE__); }
+
+	if (oldest->context) { sws_freeContext(oldest->context); }
+	if (oldest->buffer) { av_free(oldest->buffer); }
+
+	oldest->srcW = srcW;
+	oldest->srcH = srcH;
+	oldest->srcFormat = srcFormat;
+	oldest->dstW = dstW;
+	oldest->dstH = dstH;
+	oldest->dstFormat = dstFormat;
+	oldest->flags = flags;
+	oldest->context = NULL;
+	oldest->buffer = NULL;
+	return oldest;
+}
+
+static bool getChromaShift(int format, int* shiftW, int* shiftH, bool* interleaved)
+{
+	// formats with 8-bit luma in first plane and 8-bit chroma in following planes
+	*interleaved = false;
+	switch (format)
+	{
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+	case AV_PIX_FMT_YUVA420P:
+		*shiftW = 1; *shiftH = 1; return true;
+	case AV_PIX_FMT_YUV422P:
+	case AV_PIX_FMT_YUVJ422P:
+		*shiftW = 1; *shiftH = 0; return true;
+	case AV_PIX_FMT_YUV444P:
+	case AV_PIX_FMT_YUVJ444P:
+		*shiftW = 0; *shiftH = 0; return true;
+	case AV_PIX_FMT_YUV440P:
+	case AV_PIX_FMT_YUVJ440P:
+		*shiftW = 0; *shiftH = 1; return true;
+	case AV_PIX_FMT_YUV411P:
+		*shiftW = 2; *shiftH = 0; return true;
+	case AV_PIX_FMT_YUV410P:
+		*shiftW = 2; *shiftH = 2; return true;
+	case AV_PIX_FMT_NV12:
+	case AV_PIX_FMT_NV21:
+		*shiftW = 1; *shiftH = 1; *interleaved = true; return true;
+	default:
+		return false;
+	}
+}
+
+static void refreshBounds(int srcW, int srcH, int dstW, int dstH, int chromaShiftW, int chromaShiftH)
+{
+	int chromaW = -((-srcW) >> chromaShiftW);
+	int chromaH = -((-srcH) >> chromaShiftH);
+
+	if (lastSrcW == srcW && lastSrcH == srcH && lastDstW == dstW && lastDstH == dstH &&
+		lastChromaW == chromaW && lastChromaH == chromaH)
+	{
+		return;
+	}
+
+	if (lastDstW != dstW || lastDstH != dstH)
+	{
+		allocBounds(&lumaBounds, dstW, dstH);
+		allocBounds(&chromaBounds, dstW, dstH);
+
+		for (int i = 0; i < 3; i++)
+		{
+			free(cellSums[i]);
+			cellSums[i] = (uint32_t*)malloc(dstW * sizeof(uint32_t));
+			if (!cellSums[i]) { error("Failed to allocate memory!", "scaling.c", __LINE__); }
+		}
+	}
+
+	// whole luma plane row, or interleaved chroma row, is summed at once
+	size_t neededSums = (size_t)cp_max(srcW, chromaW * 2);
+	if (neededSums > columnSumsSize)
+	{
+		free(columnSums);
+		columnSums = (uint16_t*)malloc(neededSums * sizeof(uint16_t));
+		if (!columnSums) { error("Failed to allocate memory!", "scaling.c", __LINE__); }
+		columnSumsSize = neededSums;
+	}
+
+	lastSrcW = srcW;
+	lastSrcH = srcH;
+	lastDstW = dstW;
+	lastDstH = dstH;
+	lastChromaW = chromaW;
+	lastChromaH = chromaH;
+
+	// dst <= src, so every cell has at least one luma pixel
+	for (int i = 0; i < dstW; i++)
+	{
+		lumaBounds.columnStart[i] = (int)(((int64_t)i * srcW) / dstW);
+		lumaBounds.columnEnd[i] = (int)(((int64_t)(i + 1) * srcW) / dstW);
+
+		// chroma pixels covering luma pixels of a cell, neighbouring cells can share them
+		chromaBounds.columnStart[i] = lumaBounds.columnStart[i] >> chromaShiftW;
+		chromaBounds.columnEnd[i] = -((-lumaBounds.columnEnd[i]) >> chromaShiftW);
+
+		lumaBounds.columnWeight[i] = 1.0 / (lumaBounds.columnEnd[i] - lumaBounds.columnStart[i]);
+		chromaBounds.columnWeight[i] = 1.0 / (chromaBounds.columnEnd[i] - chromaBounds.columnStart[i]);
+	}
+	for (int i = 0; i < dstH; i++)
+	{
+		lumaBounds.rowStart[i] = (int)(((int64_t)i * srcH) / dstH);
+		lumaBounds.rowEnd[i] = (int)(((int64_t)(i + 1) * srcH) / dstH);
+
+		chromaBounds.rowStart[i] = lumaBounds.rowStart[i] >> chromaShiftH;
+		chromaBounds.rowEnd[i] = -((-lumaBounds.rowEnd[i]) >> chromaShiftH);
+
+		lumaBounds.rowWeight[i] = 1.0 / (lumaBounds.rowEnd[i] - lumaBounds.rowStart[i]);
+		chromaBounds.rowWeight[i] = 1.0 / (chromaBounds.rowEnd[i] - chromaBounds.rowStart[i]);
+	}
+}
+
+static void allocBounds(CellBounds* bounds, int dstW, int dstH)
+{
+	free(bounds->columnStart);
+	free(bounds->columnEnd);
+	free(bounds->rowStart);
+	free(bounds->rowEnd);
+	free(bounds->columnWeight);
+	free(bounds->rowWeight);
+
+	bounds->columnStart = (int*)malloc(dstW * sizeof(int));
+	bounds->columnEnd = (int*)malloc(dstW * sizeof(int));
+	bounds->rowStart = (int*)malloc(dstH * sizeof(int));
+	bounds->rowEnd = (int*)malloc(dstH * sizeof(int));
+	bounds->columnWeight = (double*)malloc(dstW * sizeof(double));
+	bounds->rowWeight = (double*)malloc(dstH * sizeof(double));
+
+	if (!bounds->columnStart || !bounds->columnEnd || !bounds->rowStart || !bounds->rowEnd ||
+		!bounds->columnWeight || !bounds->rowWeight)
+	{
+		error("Failed to allocate memory!", "scaling.c", __LINE__);
+	}
+}
+
+static uint32_t cellArea(CellBounds* bounds, int x, int y)
+{
+	return (uint32_t)(bounds->columnEnd[x] - bounds->columnStart[x]) *
+		(uint32_t)(bounds->rowEnd[y] - bounds->rowStart[y]);
+}
+
+static void sumCells(const uint8_t* plane, int linesize, int width, int components,
+	CellBounds* bounds, int y, int dstW, uint32_t** out)
+{
+	// "components" are interleaved in plane (2 for NV12 chroma), every one is summed into its own array
+	int firstRow = bounds->rowStart[y];
+	int rows = bounds->rowEnd[y] - firstRow;
+
+	for (int c = 0; c < components; c++) { memset(out[c], 0, dstW * sizeof(uint32_t)); }
+
+	for (int row = 0; row < rows; row += MAX_SUMMED_ROWS)
+	{
+		sumRows(plane + (int64_t)(firstRow + row) * linesize, linesize,
+			cp_min(rows - row, MAX_SUMMED_ROWS), width * components);
+
+		if (components == 1)
+		{
+			for (int x = 0; x < dstW; x++)
+			{
+				uint32_t sum = 0;
+				for (int i = bounds->columnStart[x]; i < bounds->columnEnd[x]; i++) { sum += columnSums[i]; }
+				out[0][x] += sum;
+			}
+			continue;
+		}
+
+		for (int x = 0; x < dstW; x++)
+		{
+			for (int c = 0; c < components; c++)
+			{
+				uint32_t sum = 0;
+				for (int i = bounds->columnStart[x]; i < bounds->columnEnd[x]; i++) { sum += columnSums[i * components + c]; }
+				out[c][x] += sum;
+			}
+		}
+	}
+}
+
+static void sumRows(const uint8_t* src, int linesize, int rows, int size)
+{
+	// first row is copied, next ones are added
+	for (int x = 0; x < size; x++) { columnSums[x] = src[x]; }
+
+	for (int row = 1; row < rows; row++)
+	{
+		const uint8_t* line = src + (int64_t)row * linesize;
+		int x = 0;
+
+		#if defined(CP_SCALING_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= size; x += 16)
+		{
+			__m128i pixels = _mm_loadu_si128((const __m128i*)(line + x));
+			__m128i* sums = (__m128i*)(columnSums + x);
+			_mm_storeu_si128(sums, _mm_add_epi16(_mm_loadu_si128(sums), _mm_unpacklo_epi8(pixels, zero)));
+			_mm_storeu_si128(sums + 1, _mm_add_epi16(_mm_loadu_si128(sums + 1), _mm_unpackhi_epi8(pixels, zero)));
+		}
+		#elif defined(CP_SCALING_NEON)
+		for (; x + 16 <= size; x += 16)
+		{
+			uint8x16_t pixels = vld1q_u8(line + x);
+			uint16_t* sums = columnSums + x;
+			vst1q_u16(sums, vaddw_u8(vld1q_u16(sums), vget_low_u8(pixels)));
+			vst1q_u16(sums + 8, vaddw_u8(vld1q_u16(sums + 8), vget_high_u8(pixels)));
+		}
+		#endif
+
+		for (; x < size; x++) { columnSums[x] += line[x]; }
+	}
+}
+
+static uint8_t clampColor(double val)
+{
+	// val is already rounded (+0.5)
+	if (val <= 0.0) { return 0; }
+	if (val >= 255.0) { return 255; }
+	return (uint8_t)val;
+}
+
+static bool isFullRange(const AVFrame* frame)
+{
+	switch (frame->format)
+	{
+	case AV_PIX_FMT_YUVJ420P:
+	case AV_PIX_FMT_YUVJ422P:
+	case AV_PIX_FMT_YUVJ444P:
+	case AV_PIX_FMT_YUVJ440P:
+	case AV_PIX_FMT_GRAY8:
+		return true;
+	default:
+		return frame->color_range == AVCOL_RANGE_JPEG;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "conplayer.h"
+
+// Vectorized kernels - version for the running CPU is chosen once by initSimd(), so the same
+// binary uses AVX2 when it's available and falls back to scalar code otherwise.
+// On ARM64 NEON is always available.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CP_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CP_TARGET_AVX2
+#else
+#define CP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CP_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*TranslateFuncPtr)(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table);
+typedef void (*ProcColorsFuncPtr)(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate);
+
+// Saturated channel is floor(255 * val / max). With ceil(255 * 2^16 / max) as reciprocal, error of
+// (val * reciprocal) >> 16 is smaller than val / 2^16 < 1/255, while fraction of the exact result
+// is never bigger than 1 - 1/255, so the result is always exact.
+static uint32_t saturationRecips[256];
+
+// (r * LUMA_R + g * LUMA_G + b * LUMA_B) >> 16 - 0.299, 0.587 and 0.114 with sum equal to 2^16
+static const uint32_t LUMA_R = 19595, LUMA_G = 38470, LUMA_B = 7471;
+
+// same margin as above for vectorized version, which multiplies by float 255 / max
+static const float SATURATION_EPSILON = 0.001f;
+
+static TranslateFuncPtr translateFunc = NULL;
+static ProcColorsFuncPtr procColorsFunc = NULL;
+static const char* simdName = "none";
+
+static void translateScalar(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table);
+static void procColorsScalar(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate);
+#if defined(CP_SIMD_X86)
+static bool cpuHasAvx2(void);
+static void translateAvx2(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table);
+static void procColorsAvx2(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate);
+#elif defined(CP_SIMD_NEON)
+static void translateNeon(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table);
+static void procColorsNeon(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate);
+#endif
+
+void initSimd(void)
+{
+	saturationRecips[0] = 0;
+	for (uint32_t i = 1; i < 256; i++) { saturationRecips[i] = ((255 << 16) + i - 1) / i; }
+
+	translateFunc = &translateScalar;
+	procColorsFunc = &procColorsScalar;
+
+	#if defined(CP_SIMD_X86)
+	if (cpuHasAvx2())
+	{
+		translateFunc = &translateAvx2;
+		procColorsFunc = &procColorsAvx2;
+		simdName = "AVX2";
+	}
+	#elif defined(CP_SIMD_NEON)
+	translateFunc = &translateNeon;
+	procColorsFunc = &procColorsNeon;
+	simdName = "NEON";
+	#endif
+}
+
+const char* getSimdName(void)
+{
+	return simdName;
+}
+
+void translateBytes(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table)
+{
+	// dst[i] = table[src[i]], table has 256 entries
+	translateFunc(src, dst, count, table);
+}
+
+void procColors(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b, uint8_t* luma, int count, bool saturate)
+{
+	// splits RGB24 row into channels and luma of original color, with "saturate" channels are scaled
+	// so that the largest one is equal to 255 (black becomes red, like it always did)
+	procColorsFunc(rgb, r, g, b, luma, count, saturate);
+}
+
+static void translateScalar(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table)
+{
+	for (int i = 0; i < count; i++) { dst[i] = table[src[i]]; }
+}
+
+static void procColorsScalar(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate)
+{
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t valR = rgb[i * 3], valG = rgb[i * 3 + 1], valB = rgb[i * 3 + 2];
+		luma[i] = (uint8_t)((valR * LUMA_R + valG * LUMA_G + valB * LUMA_B) >> 16);
+
+		if (saturate)
+		{
+			uint32_t max = valR > valG ? valR : valG;
+			max = max > valB ? max : valB;
+
+			uint32_t recip = saturationRecips[max];
+			r[i] = (uint8_t)(((valR * recip) >> 16) | (max ? 0 : 255));
+			g[i] = (uint8_t)((valG * recip) >> 16);
+			b[i] = (uint8_t)((valB * recip) >> 16);
+		}
+		else
+		{
+			r[i] = (uint8_t)valR;
+			g[i] = (uint8_t)valG;
+			b[i] = (uint8_t)valB;
+		}
+	}
+}
+
+#if defined(CP_SIMD_X86)
+
+static bool cpuHasAvx2(void)
+{
+	#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) { return false; }
+
+	// OS has to support XSAVE and save YMM registers
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) { return false; }
+	if ((_xgetbv(0) & 6) != 6) { return false; }
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+	#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+	#endif
+}
+
+CP_TARGET_AVX2 static void translateAvx2(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table)
+{
+	// Table is split into 16 parts of 16 bytes, every part is looked up with byte shuffle.
+	// Index is lowered by 16 for every next part and 0x70 is added with saturation, so only indexes
+	// belonging to current part keep highest bit clear - shuffle returns 0 for all others.
+	__m256i parts[16];
+	for (int i = 0; i < 16; i++) { parts[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table + i * 16))); }
+
+	const __m256i bias = _mm256_set1_epi8(0x70);
+	const __m256i step = _mm256_set1_epi8(0x10);
+	int i = 0;
+
+	for (; i + 64 <= count; i += 64)
+	{
+		__m256i index0 = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i index1 = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+		__m256i result0 = _mm256_setzero_si256();
+		__m256i result1 = _mm256_setzero_si256();
+
+		for (int j = 0; j < 16; j++)
+		{
+			result0 = _mm256_or_si256(result0, _mm256_shuffle_epi8(parts[j], _mm256_adds_epu8(index0, bias)));
+			result1 = _mm256_or_si256(result1, _mm256_shuffle_epi8(parts[j], _mm256_adds_epu8(index1, bias)));
+			index0 = _mm256_sub_epi8(index0, step);
+			index1 = _mm256_sub_epi8(index1, step);
+		}
+
+		_mm256_storeu_si256((__m256i*)(dst + i), result0);
+		_mm256_storeu_si256((__m256i*)(dst + i + 32), result1);
+	}
+
+	translateScalar(src + i, dst + i, count - i, table);
+}
+
+CP_TARGET_AVX2 static __m128i packChannelAvx2(__m256i val)
+{
+	// 8 x int32 -> 8 x uint8 in lower half
+	val = _mm256_packus_epi32(val, val);
+	val = _mm256_packus_epi16(val, val);
+	return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(val, _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4)));
+}
+
+CP_TARGET_AVX2 static void procColorsAvx2(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate)
+{
+	// 8 pixels (24 bytes) are split into channels with byte shuffles of two loads
+	const __m128i shuffleLowR = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffleLowG = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffleLowB = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffleHighR = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffleHighG = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffleHighB = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	const __m256i lumaR = _mm256_set1_epi32(LUMA_R);
+	const __m256i lumaG = _mm256_set1_epi32(LUMA_G);
+	const __m256i lumaB = _mm256_set1_epi32(LUMA_B);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256 maxVal = _mm256_set1_ps(255.0f);
+	const __m256 epsilon = _mm256_set1_ps(SATURATION_EPSILON);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i low = _mm_loadu_si128((const __m128i*)(rgb + i * 3));
+		__m128i high = _mm_loadl_epi64((const __m128i*)(rgb + i * 3 + 16));
+
+		__m256i valR = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, shuffleLowR), _mm_shuffle_epi8(high, shuffleHighR)));
+		__m256i valG = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, shuffleLowG), _mm_shuffle_epi8(high, shuffleHighG)));
+		__m256i valB = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(low, shuffleLowB), _mm_shuffle_epi8(high, shuffleHighB)));
+
+		__m256i valLuma = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(valR, lumaR),
+			_mm256_mullo_epi32(valG, lumaG)), _mm256_mullo_epi32(valB, lumaB));
+		_mm_storel_epi64((__m128i*)(luma + i), packChannelAvx2(_mm256_srli_epi32(valLuma, 16)));
+
+		if (saturate)
+		{
+			__m256i max = _mm256_max_epi32(_mm256_max_epi32(valR, valG), valB);
+			__m256i black = _mm256_cmpeq_epi32(max, zero);
+			__m256 scale = _mm256_div_ps(maxVal, _mm256_cvtepi32_ps(_mm256_max_epi32(max, one)));
+
+			valR = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(valR), scale), epsilon));
+			valG = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(valG), scale), epsilon));
+			valB = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(valB), scale), epsilon));
+			valR = _mm256_or_si256(valR, _mm256_and_si256(black, _mm256_set1_epi32(255)));
+		}
+
+		_mm_storel_epi64((__m128i*)(r + i), packChannelAvx2(valR));
+		_mm_storel_epi64((__m128i*)(g + i), packChannelAvx2(valG));
+		_mm_storel_epi64((__m128i*)(b + i), packChannelAvx2(valB));
+	}
+
+	procColorsScalar(rgb + i * 3, r + i, g + i, b + i, luma + i, count - i, saturate);
+}
+
+#elif defined(CP_SIMD_NEON)
+
+static void translateNeon(const uint8_t* src, uint8_t* dst, int count, const uint8_t* table)
+{
+	// table lookup instructions take up to 64 bytes, "tbx" keeps previous value for indexes out of range
+	uint8x16x4_t parts[4];
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++) { parts[i].val[j] = vld1q_u8(table + i * 64 + j * 16); }
+	}
+
+	const uint8x16_t step = vdupq_n_u8(64);
+	int i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		uint8x16_t index = vld1q_u8(src + i);
+		uint8x16_t result = vqtbl4q_u8(parts[0], index);
+
+		index = vsubq_u8(index, step);
+		result = vqtbx4q_u8(result, parts[1], index);
+		index = vsubq_u8(index, step);
+		result = vqtbx4q_u8(result, parts[2], index);
+		index = vsubq_u8(index, step);
+		result = vqtbx4q_u8(result, parts[3], index);
+
+		vst1q_u8(dst + i, result);
+	}
+
+	translateScalar(src + i, dst + i, count - i, table);
+}
+
+static uint8x8_t saturateNeon(uint16x8_t val, float32x4_t scaleLow, float32x4_t scaleHigh)
+{
+	const float32x4_t epsilon = vdupq_n_f32(SATURATION_EPSILON);
+	float32x4_t low = vmlaq_f32(epsilon, vcvtq_f32_u32(vmovl_u16(vget_low_u16(val))), scaleLow);
+	float32x4_t high = vmlaq_f32(epsilon, vcvtq_f32_u32(vmovl_u16(vget_high_u16(val))), scaleHigh);
+	return vmovn_u16(vcombine_u16(vmovn_u32(vcvtq_u32_f32(low)), vmovn_u32(vcvtq_u32_f32(high))));
+}
+
+static void procColorsNeon(const uint8_t* rgb, uint8_t* r, uint8_t* g, uint8_t* b,
+	uint8_t* luma, int count, bool saturate)
+{
+	const float32x4_t maxVal = vdupq_n_f32(255.0f);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		uint8x8x3_t pixels = vld3_u8(rgb + i * 3);
+		uint16x8_t valR = vmovl_u8(pixels.val[0]);
+		uint16x8_t valG = vmovl_u8(pixels.val[1]);
+		uint16x8_t valB = vmovl_u8(pixels.val[2]);
+
+		uint32x4_t lumaLow = vmull_n_u16(vget_low_u16(valR), LUMA_R);
+		lumaLow = vmlal_n_u16(lumaLow, vget_low_u16(valG), LUMA_G);
+		lumaLow = vmlal_n_u16(lumaLow, vget_low_u16(valB), LUMA_B);
+		uint32x4_t lumaHigh = vmull_n_u16(vget_high_u16(valR), LUMA_R);
+		lumaHigh = vmlal_n_u16(lumaHigh, vget_high_u16(valG), LUMA_G);
+		lumaHigh = vmlal_n_u16(lumaHigh, vget_high_u16(valB), LUMA_B);
+		vst1_u8(luma + i, vmovn_u16(vcombine_u16(vshrn_n_u32(lumaLow, 16), vshrn_n_u32(lumaHigh, 16))));
+
+		if (saturate)
+		{
+			uint16x8_t max = vmaxq_u16(vmaxq_u16(valR, valG), valB);
+			uint16x8_t divisor = vmaxq_u16(max, vdupq_n_u16(1));
+			float32x4_t scaleLow = vdivq_f32(maxVal, vcvtq_f32_u32(vmovl_u16(vget_low_u16(divisor))));
+			float32x4_t scaleHigh = vdivq_f32(maxVal, vcvtq_f32_u32(vmovl_u16(vget_high_u16(divisor))));
+
+			uint8x8_t black = vmovn_u16(vceqq_u16(max, vdupq_n_u16(0)));
+			pixels.val[0] = vorr_u8(saturateNeon(valR, scaleLow, scaleHigh), black);
+			pixels.val[1] = saturateNeon(valG, scaleLow, scaleHigh);
+			pixels.val[2] = saturateNeon(valB, scaleLow, scaleHigh);
+		}
+
+		vst1_u8(r + i, pixels.val[0]);
+		vst1_u8(g + i, pixels.val[1]);
+		vst1_u8(b + i, pixels.val[2]);
+	}
+
+	procColorsScalar(rgb + i * 3, r + i, g + i, b + i, luma + i, count - i, saturate);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "conplayer.h"
+
+Stats stats =
+{
+	.queueDepth = 0,
+	.queueMinDepthSeen = INT_MAX,
+	.queueMaxDepthSeen = 0,
+	.queueAllocatedSlots = 0,
+	.queueSlotSize = 0,
+	.queueOccupancySum = 0,
+	.queueOccupancySamples = 0,
+	.queueMaxOccupancy = 0,
+	.queueUnderruns = 0,
+	.decodeSkipLevel = 0,
+	.decodeSkipMaxLevel = 0,
+	.decodeSkipChanges = 0,
+	.decodeSkipPackets = 0,
+	.decodePackets = 0,
+	.decoderThreads = 0,
+	.decoderThreadType = 0,
+	.decodedFrames = 0,
+	.decodeTime = 0,
+	.firstDecodedTime = 0, .lastDecodedTime = 0,
+	.directScaledFrames = 0,
+	.swsScaledFrames = 0,
+	.scaleTime = 0,
+	.swsContextsCreated = 0,
+	.swsCacheHits = 0,
+	.poolAllocated = 0,
+	.poolReused = 0,
+	.poolHugePageBuffers = 0,
+	.seekCount = 0,
+	.seekLatencySum = 0.0, .seekLatencyMax = 0.0, .seekLatencyLast = 0.0,
+	.seekDroppedFrames = 0,
+	.pacingFrames = 0,
+	.pacingLateFrames = 0,
+	.pacingJitterSum = 0.0, .pacingJitterSqSum = 0.0, .pacingJitterMax = 0.0,
+	.syncFrames = 0,
+	.syncDroppedFrames = 0,
+	.lateDroppedFrames = 0,
+	.consoleSkippedFrames = 0,
+	.drawnFrames = 0,
+	.fullRedraws = 0,
+	.drawnBytes = 0,
+	.syncDriftSum = 0.0, .syncDriftMax = 0.0
+};
+
+void printStats(void)
+{
+	const double MB = 1024.0 * 1024.0;
+
+	double avgOccupancy = stats.queueOccupancySamples ?
+		(double)stats.queueOccupancySum / (double)stats.queueOccupancySamples : 0.0;
+
+	puts("\nStatistics:");
+	printf(" Queue depth:      %d (min %d, max %d)\n", stats.queueDepth,
+		stats.queueMinDepthSeen == INT_MAX ? stats.queueDepth : stats.queueMinDepthSeen,
+		stats.queueMaxDepthSeen);
+	printf(" Queue occupancy:  %.1f average, %d max\n", avgOccupancy, stats.queueMaxOccupancy);
+	printf(" Queue underruns:  %d\n", stats.queueUnderruns);
+	printf(" Queue memory:     %d slots * %.2f MB = %.2f MB\n", stats.queueAllocatedSlots,
+		(double)stats.queueSlotSize / MB,
+		((double)stats.queueSlotSize * (double)stats.queueAllocatedSlots) / MB);
+	if (stats.decodedFrames)
+	{
+		// with frame threading most of decoding is done outside of decoder calls, so throughput is
+		// measured with wall clock - it's limited by playback speed unless synchronization is disabled
+		int64_t decodeWallTime = stats.lastDecodedTime - stats.firstDecodedTime;
+
+		printf(" Video decoder:    %d threads, %s, %.1f fps wall clock (%" PRId64 " frames), %.1f%% of it in decoder calls\n",
+			stats.decoderThreads, getDecoderThreadTypeName(stats.decoderThreadType),
+			decodeWallTime ? ((double)(stats.decodedFrames - 1) * 1000000000.0) / decodeWallTime : 0.0,
+			stats.decodedFrames,
+			decodeWallTime ? ((double)stats.decodeTime * 100.0) / decodeWallTime : 0.0);
+	}
+	if (stats.directScaledFrames + stats.swsScaledFrames)
+	{
+		printf(" Scaling:          %.3f ms per frame (%" PRId64 " from decoded planes, %" PRId64 " with swscale)\n",
+			((double)stats.scaleTime / (stats.directScaledFrames + stats.swsScaledFrames)) / 1000000.0,
+			stats.directScaledFrames, stats.swsScaledFrames);
+	}
+	if (stats.swsContextsCreated)
+	{
+		printf(" Scaling contexts: %d created, %d reused from cache\n",
+			stats.swsContextsCreated, stats.swsCacheHits);
+	}
+	if (settings.adaptiveSkip)
+	{
+		printf(" Decoder skipping: level %d (max %d, %d changes), %.1f%% packets decoded with skipping\n",
+			stats.decodeSkipLevel, stats.decodeSkipMaxLevel, stats.decodeSkipChanges,
+			stats.decodePackets ? ((double)stats.decodeSkipPackets * 100.0) / stats.decodePackets : 0.0);
+	}
+	printf(" Buffer pool:      %.2f MB allocated, %" PRId64 " buffers reused, %d with huge pages\n",
+		(double)stats.poolAllocated / MB, stats.poolReused, stats.poolHugePageBuffers);
+
+	if (stats.seekCount)
+	{
+		printf(" Seek latency:     %.1f ms average, %.1f ms max, %.1f ms last (%d seeks)\n",
+			(stats.seekLatencySum / stats.seekCount) * 1000.0, stats.seekLatencyMax * 1000.0,
+			stats.seekLatencyLast * 1000.0, stats.seekCount);
+		printf(" Seek drops:       %" PRId64 " frames loaded before seek\n", stats.seekDroppedFrames);
+	}
+
+	if (stats.pacingFrames)
+	{
+		double avgJitter = stats.pacingJitterSum / stats.pacingFrames;
+		double jitterDeviation = sqrt(fmax(stats.pacingJitterSqSum / stats.pacingFrames -
+			avgJitter * avgJitter, 0.0));
+
+		printf(" Pacing jitter:    %.3f ms average, %.3f ms deviation, %.3f ms max\n",
+			avgJitter * 1000.0, jitterDeviation * 1000.0, stats.pacingJitterMax * 1000.0);
+		printf(" Late frames:      %" PRId64 " of %" PRId64 "\n", stats.pacingLateFrames,
+			stats.pacingFrames + stats.pacingLateFrames);
+	}
+
+	if (stats.syncFrames)
+	{
+		printf(" A/V drift:        %.1f ms average, %.1f ms max\n",
+			(stats.syncDriftSum / stats.syncFrames) * 1000.0, stats.syncDriftMax * 1000.0);
+		printf(" Sync drops:       %" PRId64 " before processing, %" PRId64 " before drawing\n",
+			psnip_atomic_int64_load(&stats.lateDroppedFrames), stats.syncDroppedFrames);
+	}
+
+	if (stats.consoleSkippedFrames)
+	{
+		printf(" Console skips:    %" PRId64 " frames replaced before they were displayed\n",
+			stats.consoleSkippedFrames);
+	}
+
+	if (stats.drawnFrames)
+	{
+		printf(" Drawing:          %.1f KB per frame", ((double)stats.drawnBytes / stats.drawnFrames) / 1024.0);
+		if (settings.deltaDraw) { printf(" (%" PRId64 " of %" PRId64 " frames redrawn whole)", stats.fullRedraws, stats.drawnFrames); }
+		putchar('\n');
+	}
+}
+
+const char* getDecoderThreadTypeName(int activeThreadType)
+{
+	if (activeThreadType & FF_THREAD_FRAME) { return "frame threading"; }
+	else if (activeThreadType & FF_THREAD_SLICE) { return "slice threading"; }
+	return "no threading";
+}
\ No newline at end of file
@@ -4,44 +4,109 @@ typedef struct
 {
 	void* output;
 	int* outputLineOffsets;
+	Cell* cells;
 	int w, h;
 } ConsoleFrame;
 
-const int SLEEP_ON_FREEZE = 4;
-volatile bool freezeThreads = false;
-volatile bool mainFreezed = false;
-volatile bool procFreezed = false;
-volatile bool drawFreezed = false;
+typedef struct
+{
+	ThreadIDType threadID;
+	uint32_t randState;
+} ProcWorker;
+
+typedef struct
+{
+	BandFuncPtr bandFunc;
+	void* args;
+	int bandCount;
+	int nextBand;
+	int finishedBands;
+} BandJob;
 
 static const double TIME_TO_RESET_TIMER = 0.5;
+static const int MAX_PROC_THREADS = 16;
+static const int64_t MAX_SYNC_WAIT = AV_TIME_BASE;
+static const int CONSOLE_FRAME_INDEX = 0x3;
+static const int CONSOLE_FRAME_NEW = 0x4;
 
-static ThreadIDType procThreadID = 0;
+static ProcWorker* procWorkers = NULL;
+static int bandHelperCount = 0;
 static ThreadIDType drawThreadID = 0;
 static ThreadIDType audioThreadID = 0;
 static ThreadIDType consoleThreadID = 0;
 static ThreadIDType keyboardThreadID = 0;
-static double startTime;
+static int64_t startTime; // ns, time of frame before the first drawn one
 static int frameCounter;
 static int64_t drawFrameTime = 0;
+static int drawnGeneration = 0;
+static bool seekPending = false; // frame of new generation was dequeued, but none was drawn yet
+static double seekTime = -1.0; // when last seek was requested, -1 after first frame is drawn
 static volatile bool paused = false;
-static volatile ConsoleFrame consoleFrame;
-static volatile bool waitingForFrame = false;
+// triple buffer - draw thread fills one frame, console thread displays another and the third one
+// is the newest complete frame, frames change owners by swapping index of the ready one
+static ConsoleFrame consoleFrames[3];
+static int consoleWriteIndex = 0;
+static int consoleDisplayIndex = 1;
+static psnip_atomic_int32 consoleReadyIndex = 2; // with CONSOLE_FRAME_NEW if not displayed yet
+static Mutex pauseMutex;
+static CondVar pauseChanged;
+static Mutex consoleMutex;
+static CondVar consoleFrameChanged;
+static BandJob bandJob;
+static Mutex bandMutex;
+static CondVar bandJobStarted;
+static CondVar bandJobFinished;
 
 static ThreadRetType CP_CALL_CONV procThread(void* ptr);
 static ThreadRetType CP_CALL_CONV drawThread(void* ptr);
 static ThreadRetType CP_CALL_CONV audioThread(void* ptr);
 static ThreadRetType CP_CALL_CONV consoleThread(void* ptr);
 static ThreadRetType CP_CALL_CONV keyboardThread(void* ptr);
+static ThreadRetType CP_CALL_CONV bandThread(void* ptr);
+static void finishBands(void);
+static void publishConsoleFrame(Frame* frame);
+static void setPaused(bool newPaused);
 static void seek(int64_t timestamp);
+static void measureSeek(void);
+static bool syncFrame(Frame* frame);
+static void paceFrame(int64_t deadline);
 
 void beginThreads(void)
 {
-	consoleFrame.output = NULL;
-	consoleFrame.outputLineOffsets = NULL;
-	consoleFrame.w = -1;
-	consoleFrame.h = -1;
+	initMutex(&pauseMutex);
+	initCondVar(&pauseChanged);
+	initMutex(&consoleMutex);
+	initCondVar(&consoleFrameChanged);
+	initMutex(&bandMutex);
+	initCondVar(&bandJobStarted);
+	initCondVar(&bandJobFinished);
+
+	bandJob.bandFunc = NULL;
+
+	for (int i = 0; i < 3; i++)
+	{
+		consoleFrames[i].output = NULL;
+		consoleFrames[i].outputLineOffsets = NULL;
+		consoleFrames[i].cells = NULL;
+		consoleFrames[i].w = -1;
+		consoleFrames[i].h = -1;
+	}
+
+	// main, draw and console threads are busy most of the time, so leave cores for them
+	if (settings.procThreads <= 0) { settings.procThreads = getCpuCount() - 2; }
+	settings.procThreads = cp_clamp(settings.procThreads, 1, MAX_PROC_THREADS);
+
+	procWorkers = (ProcWorker*)malloc(settings.procThreads * sizeof(ProcWorker));
+	for (int i = 0; i < settings.procThreads; i++)
+	{
+		procWorkers[i].randState = 0x9E3779B9u * (uint32_t)(i + 1);
+		procWorkers[i].threadID = startThread(&procThread, &procWorkers[i]);
+	}
+
+	// thread that runs bands waits for them anyway, so it can work on them too
+	bandHelperCount = settings.procThreads - 1;
+	for (int i = 0; i < bandHelperCount; i++) { startThread(&bandThread, NULL); }
 
-	procThreadID = startThread(&procThread, NULL);
 	drawThreadID = startThread(&drawThread, NULL);
 	if (!settings.disableAudio) { audioThreadID = startThread(&audioThread, NULL); }
 	if (settings.syncMode == SYNC_ENABLED) { consoleThreadID = startThread(&consoleThread, NULL); }
@@ -50,108 +115,158 @@ void beginThreads(void)
 
 static ThreadRetType CP_CALL_CONV procThread(void* ptr)
 {
+	ProcWorker* worker = (ProcWorker*)ptr;
+
+	// frames can be finished out of order, draw thread takes them back in sequence order
 	while (true)
 	{
-		while (freezeThreads && !decodeEnd)
+		Frame* frame = dequeueFrame(STAGE_LOADED_FRAME);
+
+		// frames loaded before seek or already too late to be shown are only passed on,
+		// draw thread drops them
+		frame->late = false;
+		if (frame->generation == psnip_atomic_int32_load(&seekGeneration))
 		{
-			procFreezed = true;
-			Sleep(SLEEP_ON_FREEZE);
+			frame->late = isFrameLate(frame);
+			if (frame->late) { CP_ATOMIC_FETCH_ADD64(&stats.lateDroppedFrames, 1); }
+			else { processFrame(frame, &worker->randState); }
 		}
+		enqueueFrame(frame, STAGE_PROCESSED_FRAME);
+	}
+
+	CP_END_THREAD
+}
+
+void runBands(BandFuncPtr bandFunc, void* args, int bandCount)
+{
+	lockMutex(&bandMutex);
+
+	// helpers are already busy with band job of another frame,
+	// in that case all processing threads have work anyway
+	if (bandJob.bandFunc || !bandHelperCount)
+	{
+		unlockMutex(&bandMutex);
+		for (int i = 0; i < bandCount; i++) { bandFunc(args, i); }
+		return;
+	}
+
+	bandJob.bandFunc = bandFunc;
+	bandJob.args = args;
+	bandJob.bandCount = bandCount;
+	bandJob.nextBand = 0;
+	bandJob.finishedBands = 0;
+	wakeCondVar(&bandJobStarted);
 
-		Frame* frame = dequeueFrame(STAGE_LOADED_FRAME, &procFreezed);
-		if (!frame->isAudio)
+	finishBands();
+	while (bandJob.finishedBands < bandJob.bandCount)
+	{
+		waitCondVar(&bandJobFinished, &bandMutex);
+	}
+
+	bandJob.bandFunc = NULL;
+	unlockMutex(&bandMutex);
+}
+
+static ThreadRetType CP_CALL_CONV bandThread(void* ptr)
+{
+	lockMutex(&bandMutex);
+	while (true)
+	{
+		while (!bandJob.bandFunc || bandJob.nextBand >= bandJob.bandCount)
 		{
-			processFrame(frame);
+			waitCondVar(&bandJobStarted, &bandMutex);
 		}
-		enqueueFrame(STAGE_PROCESSED_FRAME);
+		finishBands();
 	}
 
 	CP_END_THREAD
 }
 
-static ThreadRetType CP_CALL_CONV drawThread(void* ptr)
+static void finishBands(void)
 {
-	const int SLEEP_ON_PAUSE = 10;
+	// called with bandMutex locked
+	while (bandJob.nextBand < bandJob.bandCount)
+	{
+		BandFuncPtr bandFunc = bandJob.bandFunc;
+		void* args = bandJob.args;
+		int band = bandJob.nextBand;
+		bandJob.nextBand++;
+
+		unlockMutex(&bandMutex);
+		bandFunc(args, band);
+		lockMutex(&bandMutex);
+
+		bandJob.finishedBands++;
+		if (bandJob.finishedBands == bandJob.bandCount) { wakeCondVar(&bandJobFinished); }
+	}
+}
 
+static ThreadRetType CP_CALL_CONV drawThread(void* ptr)
+{
 	while (true)
 	{
-		while (freezeThreads && !decodeEnd)
+		lockMutex(&pauseMutex);
+		while (paused)
 		{
-			drawFreezed = true;
-			Sleep(SLEEP_ON_FREEZE);
+			frameCounter = 0;
+			waitCondVar(&pauseChanged, &pauseMutex);
 		}
+		unlockMutex(&pauseMutex);
 
-		while (paused)
+		Frame* frame = dequeueFrame(STAGE_PROCESSED_FRAME);
+		if (frame->generation != psnip_atomic_int32_load(&seekGeneration))
 		{
+			stats.seekDroppedFrames++;
+			enqueueFrame(frame, STAGE_FREE);
+			continue;
+		}
+
+		if (frame->generation != drawnGeneration)
+		{
+			// first frame after seek, timer starts again
+			drawnGeneration = frame->generation;
 			frameCounter = 0;
-			Sleep(SLEEP_ON_PAUSE);
+			seekPending = true;
+		}
+
+		if (frame->time != AV_NOPTS_VALUE) { drawFrameTime = frame->time; }
+
+		if (frame->late)
+		{
+			enqueueFrame(frame, STAGE_FREE);
+			continue;
 		}
 
-		Frame* frame = dequeueFrame(STAGE_PROCESSED_FRAME, &drawFreezed);
 		if (settings.syncMode == SYNC_DISABLED)
 		{
-			if (!frame->isAudio)
-			{
-				drawFrameTime = frame->time;
-				drawFrame(frame->output, frame->outputLineOffsets,
-					frame->w, frame->h);
-			}
+			drawFrame(frame->output, frame->outputLineOffsets,
+				frame->cells, frame->w, frame->h);
 		}
 		else
 		{
-			if (frame->isAudio)
+			if (!syncFrame(frame))
 			{
-				if (!settings.disableAudio) { playAudio(frame); }
+				stats.syncDroppedFrames++;
+				enqueueFrame(frame, STAGE_FREE);
+				continue;
 			}
-			else
+
+			if (settings.syncMode == SYNC_DRAW_ALL)
 			{
-				drawFrameTime = frame->time;
-				if (!frameCounter) { startTime = getTime(); }
-				double curTime = getTime() - startTime;
-				int curFrame = (int)(curTime * fps);
-				if (curFrame <= frameCounter)
-				{
-					double timeToSleep = ((frameCounter + 1) / fps) - curTime;
-					Sleep((DWORD)(timeToSleep * 1000.0));
-				}
-
-				if (settings.syncMode == SYNC_DRAW_ALL)
-				{
-					drawFrame(frame->output, frame->outputLineOffsets,
-						frame->w, frame->h);
-				}
-				else
-				{
-					if (waitingForFrame)
-					{
-						int outputArraySize = (int)getOutputArraySize(frame->w, frame->h);
-						int lineOffsetsArraySize = (frame->h + 1) * sizeof(int);
-
-						if (frame->w != consoleFrame.w ||
-							frame->h != consoleFrame.h)
-						{
-							if (consoleFrame.output) { free(consoleFrame.output); }
-							if (consoleFrame.outputLineOffsets) { free(consoleFrame.outputLineOffsets); }
-
-							consoleFrame.output = malloc(outputArraySize);
-							consoleFrame.outputLineOffsets = (int*)malloc(lineOffsetsArraySize);
-							consoleFrame.w = frame->w;
-							consoleFrame.h = frame->h;
-						}
-
-						memcpy(consoleFrame.output, frame->output, outputArraySize);
-						memcpy(consoleFrame.outputLineOffsets, frame->outputLineOffsets,
-							lineOffsetsArraySize);
-
-						waitingForFrame = false;
-					}
-				}
-				
-				frameCounter++;
+				drawFrame(frame->output, frame->outputLineOffsets,
+					frame->cells, frame->w, frame->h);
 			}
+			else { publishConsoleFrame(frame); }
 		}
 
-		enqueueFrame(STAGE_FREE);
+		if (seekPending)
+		{
+			// late and out of sync frames were dropped above, so latency ends with the first shown frame
+			seekPending = false;
+			measureSeek();
+		}
+
+		enqueueFrame(frame, STAGE_FREE);
 	}
 
 	CP_END_THREAD
@@ -161,17 +276,54 @@ static ThreadRetType CP_CALL_CONV consoleThread(void* ptr)
 {
 	while (true)
 	{
-		waitingForFrame = true;
-		while (waitingForFrame) { Sleep(0); }
+		lockMutex(&consoleMutex);
+		while (!(CP_ATOMIC_LOAD_ACQUIRE(&consoleReadyIndex) & CONSOLE_FRAME_NEW))
+		{
+			waitCondVar(&consoleFrameChanged, &consoleMutex);
+		}
+		unlockMutex(&consoleMutex);
 
-		drawFrame(consoleFrame.output,
-			consoleFrame.outputLineOffsets,
-			consoleFrame.w, consoleFrame.h);
+		// frames published while the previous one was drawn are skipped, only the newest is drawn
+		consoleDisplayIndex = CP_ATOMIC_EXCHANGE(&consoleReadyIndex, consoleDisplayIndex) & CONSOLE_FRAME_INDEX;
+		ConsoleFrame* consoleFrame = &consoleFrames[consoleDisplayIndex];
+
+		drawFrame(consoleFrame->output,
+			consoleFrame->outputLineOffsets,
+			consoleFrame->cells,
+			consoleFrame->w, consoleFrame->h);
 	}
 
 	CP_END_THREAD
 }
 
+static void publishConsoleFrame(Frame* frame)
+{
+	// output buffers are exchanged with the queue slot instead of copied,
+	// slot gets buffers of the console frame and resizes them when it's loaded again
+	ConsoleFrame* consoleFrame = &consoleFrames[consoleWriteIndex];
+
+	void* output = consoleFrame->output;
+	int* outputLineOffsets = consoleFrame->outputLineOffsets;
+	Cell* cells = consoleFrame->cells;
+	consoleFrame->output = frame->output;
+	consoleFrame->outputLineOffsets = frame->outputLineOffsets;
+	consoleFrame->cells = frame->cells;
+	consoleFrame->w = frame->w;
+	consoleFrame->h = frame->h;
+	frame->output = output;
+	frame->outputLineOffsets = outputLineOffsets;
+	frame->cells = cells;
+
+	int oldReadyIndex = CP_ATOMIC_EXCHANGE(&consoleReadyIndex, consoleWriteIndex | CONSOLE_FRAME_NEW);
+	consoleWriteIndex = oldReadyIndex & CONSOLE_FRAME_INDEX;
+	if (oldReadyIndex & CONSOLE_FRAME_NEW) { stats.consoleSkippedFrames++; }
+
+	// console thread checks ready index with mutex locked before it waits, so wakeup isn't lost
+	lockMutex(&consoleMutex);
+	wakeCondVar(&consoleFrameChanged);
+	unlockMutex(&consoleMutex);
+}
+
 static ThreadRetType CP_CALL_CONV audioThread(void* ptr)
 {
 	audioLoop();
@@ -209,7 +361,7 @@ static ThreadRetType CP_CALL_CONV keyboardThread(void* ptr)
 			break;
 
 		case VK_SPACE:
-			paused = !paused;
+			setPaused(!paused);
 			break;
 
 		case VK_LEFT:
@@ -253,19 +405,115 @@ static ThreadRetType CP_CALL_CONV keyboardThread(void* ptr)
 	CP_END_THREAD
 }
 
+void waitWhilePaused(void)
+{
+	lockMutex(&pauseMutex);
+	while (paused) { waitCondVar(&pauseChanged, &pauseMutex); }
+	unlockMutex(&pauseMutex);
+}
+
+static void setPaused(bool newPaused)
+{
+	lockMutex(&pauseMutex);
+	paused = newPaused;
+	wakeCondVar(&pauseChanged);
+	unlockMutex(&pauseMutex);
+}
+
 static void seek(int64_t timestamp)
 {
-	freezeThreads = true;
-	paused = false;
+	setPaused(false);
 	if (timestamp < 0) { timestamp = 0; }
 
-	while (!mainFreezed || !procFreezed || !drawFreezed) { Sleep(SLEEP_ON_FREEZE); }
-	while (decodeEnd) { Sleep(30); }
-	initQueue();
+	// nothing is stopped, frames loaded before seek are dropped on their way through the queue
+	lockMutex(&pauseMutex);
+	if (seekTime < 0.0) { seekTime = getTime(); }
+	unlockMutex(&pauseMutex);
+
+	drawFrameTime = timestamp;
 	avSeek(timestamp);
+}
+
+bool isFrameLate(Frame* frame)
+{
+	// frame is late when it's behind audio clock by more than sync threshold,
+	// without audio clock frames are paced by frame rate and never late
+	int64_t audioTime;
+	if (settings.syncMode != SYNC_ENABLED || frame->time == AV_NOPTS_VALUE ||
+		!getAudioClock(&audioTime))
+	{
+		return false;
+	}
+
+	return frame->time - audioTime < -(int64_t)settings.syncThreshold * (AV_TIME_BASE / 1000);
+}
+
+static void measureSeek(void)
+{
+	// time from key press to first frame drawn after seek,
+	// when seeks are repeated before frame is drawn it's measured from the first one
+	lockMutex(&pauseMutex);
+	if (seekTime >= 0.0)
+	{
+		double latency = getTime() - seekTime;
+		seekTime = -1.0;
+
+		stats.seekCount++;
+		stats.seekLatencySum += latency;
+		stats.seekLatencyLast = latency;
+		if (latency > stats.seekLatencyMax) { stats.seekLatencyMax = latency; }
+	}
+	unlockMutex(&pauseMutex);
+}
+
+static bool syncFrame(Frame* frame)
+{
+	// returns false if frame is too late and should be dropped,
+	// video follows audio clock while audio is playing, otherwise it's paced by frame rate
+	int64_t audioTime;
+	if (frame->time != AV_NOPTS_VALUE && getAudioClock(&audioTime))
+	{
+		int64_t drift = frame->time - audioTime;
+		double driftSeconds = (double)drift / AV_TIME_BASE;
+
+		stats.syncFrames++;
+		stats.syncDriftSum += driftSeconds;
+		if (fabs(driftSeconds) > stats.syncDriftMax) { stats.syncDriftMax = fabs(driftSeconds); }
+
+		// frame rate timer starts again when audio clock isn't available
+		frameCounter = 0;
+
+		if (settings.syncMode == SYNC_ENABLED &&
+			drift < -(int64_t)settings.syncThreshold * (AV_TIME_BASE / 1000))
+		{
+			return false;
+		}
+
+		// with broken timestamps video shouldn't stop for too long
+		if (drift > 0) { paceFrame(getTimeNs() + (drift < MAX_SYNC_WAIT ? drift : MAX_SYNC_WAIT) * 1000); }
+		return true;
+	}
+
+	if (!frameCounter) { startTime = getTimeNs(); }
+	paceFrame(startTime + (int64_t)(((double)(frameCounter + 1) * 1000000000.0) / fps));
+	frameCounter++;
+	return true;
+}
+
+static void paceFrame(int64_t deadline)
+{
+	// deadlines are absolute, so sleep inaccuracy of one frame doesn't shift following ones
+	if (getTimeNs() >= deadline)
+	{
+		stats.pacingLateFrames++;
+		return;
+	}
+
+	sleepUntilNs(deadline);
 
-	freezeThreads = false;
-	mainFreezed = false;
-	procFreezed = false;
-	drawFreezed = false;
+	double jitter = (double)(getTimeNs() - deadline) / 1000000000.0;
+	stats.pacingFrames++;
+	stats.pacingJitterSum += jitter;
+	stats.pacingJitterSqSum += jitter * jitter;
+	if (jitter > stats.pacingJitterMax) { stats.pacingJitterMax = jitter; }
 }
\ No newline at end of file
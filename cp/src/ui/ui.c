@@ -350,7 +350,7 @@ static void* selector_scalingMode(UISelectorAction action, void* arg)
 	switch (action)
 	{
 	case UI_SELECTOR_GET_COUNT:
-		return (void*)4;
+		return (void*)6;
 
 	case UI_SELECTOR_GET_POS:
 		return (void*)(int64_t)settings.scalingMode;
@@ -362,6 +362,8 @@ static void* selector_scalingMode(UISelectorAction action, void* arg)
 		case SM_FAST_BILINEAR: return "fast-bilinear";
 		case SM_BILINEAR: return "bilinear";
 		case SM_BICUBIC: return "bicubic";
+		case SM_AREA: return "area";
+		case SM_AUTO: return "auto";
 		default: selectorError(__LINE__);
 		}
 		break;
@@ -370,7 +372,7 @@ static void* selector_scalingMode(UISelectorAction action, void* arg)
 		return selector_scalingMode(UI_SELECTOR_GET_NAME, selector_scalingMode(UI_SELECTOR_GET_POS, NULL));
 
 	case UI_SELECTOR_SELECT:
-		if (pos < SM_NEAREST || pos > SM_BICUBIC) { selectorError(__LINE__); }
+		if (pos < SM_NEAREST || pos > SM_AUTO) { selectorError(__LINE__); }
 		settings.scalingMode = (ScalingMode)pos;
 		uiPopMenu();
 	}
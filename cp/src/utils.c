@@ -4,6 +4,12 @@
 #define CP_MAX_NEW_TITLE_LEN 128
 #define CP_WAIT_FOR_SET_TITLE 100
 
+#ifdef _MSC_VER
+#define CP_THREAD_LOCAL __declspec(thread)
+#else
+#define CP_THREAD_LOCAL __thread
+#endif
+
 #ifndef _WIN32
 static void setTermios(bool deinit);
 #endif
@@ -25,17 +31,108 @@ int cp_clamp(int val, int min, int max)
 	else { return val; }
 }
 
+uint32_t cpRand(uint32_t* state)
+{
+	// xorshift32, state is per thread so processing threads don't share rand() state
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+int32_t atomicExchange(psnip_atomic_int32* object, int32_t desired)
+{
+	// used by CP_ATOMIC_EXCHANGE only when compiler has no exchange builtin
+	int32_t expected;
+	do { expected = psnip_atomic_int32_load(object); }
+	while (!psnip_atomic_int32_compare_exchange(object, &expected, desired));
+	return expected;
+}
+
+int getCpuCount(void)
+{
+	#ifdef _WIN32
+
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	return (int)systemInfo.dwNumberOfProcessors;
+
+	#else
+
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+
+	#endif
+}
+
 double getTime(void)
 {
+	return (double)getTimeNs() / 1000000000.0;
+}
+
+int64_t getTimeNs(void)
+{
+	// monotonic, so it isn't affected by system time changes
+	#ifdef _WIN32
+
+	static LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER counter;
+
+	if (!frequency.QuadPart) { QueryPerformanceFrequency(&frequency); }
+	QueryPerformanceCounter(&counter);
+
+	// split to avoid overflow of counter * 10^9
+	int64_t seconds = counter.QuadPart / frequency.QuadPart;
+	int64_t rest = counter.QuadPart % frequency.QuadPart;
+	return (seconds * 1000000000) + ((rest * 1000000000) / frequency.QuadPart);
+
+	#else
+
+	struct timespec timeSpec;
+	clock_gettime(CLOCK_MONOTONIC, &timeSpec);
+	return ((int64_t)timeSpec.tv_sec * 1000000000) + timeSpec.tv_nsec;
+
+	#endif
+}
+
+void sleepUntilNs(int64_t deadline)
+{
+	// deadline is absolute time from getTimeNs()
 	#ifdef _WIN32
 
-	return (double)clock() / (double)CLOCKS_PER_SEC;
+	#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+	#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+	#endif
+
+	// every thread gets its own timer, created with the first sleep and kept as long as the thread runs,
+	// high resolution timer isn't available before Windows 10 1803, Sleep() is used then
+	static CP_THREAD_LOCAL HANDLE timer = NULL;
+	static CP_THREAD_LOCAL bool timerCreated = false;
+
+	int64_t timeToSleep = deadline - getTimeNs();
+	if (timeToSleep <= 0) { return; }
+
+	if (!timerCreated)
+	{
+		timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		timerCreated = true;
+	}
+
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -(timeToSleep / 100); // relative, in 100 ns units
+	if (timer && SetWaitableTimer(timer, &dueTime, 0, NULL, NULL, FALSE)) { WaitForSingleObject(timer, INFINITE); }
+	else { Sleep((DWORD)(timeToSleep / 1000000)); }
 
 	#else
 
 	struct timespec timeSpec;
-	clock_gettime(CLOCK_REALTIME, &timeSpec);
-	return (double)((timeSpec.tv_nsec / 1000000) + (timeSpec.tv_sec * 1000)) / 1000.0;
+	timeSpec.tv_sec = (time_t)(deadline / 1000000000);
+	timeSpec.tv_nsec = (long)(deadline % 1000000000);
+
+	// absolute deadline, so sleep interrupted by a signal is just repeated
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &timeSpec, NULL) == EINTR) {}
 
 	#endif
 }
@@ -55,6 +152,91 @@ ThreadIDType startThread(ThreadFuncPtr threadFunc, void* args)
 	#endif
 }
 
+void initMutex(Mutex* mutex)
+{
+	#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+	#else
+	pthread_mutex_init(mutex, NULL);
+	#endif
+}
+
+void lockMutex(Mutex* mutex)
+{
+	#ifdef _WIN32
+	EnterCriticalSection(mutex);
+	#else
+	pthread_mutex_lock(mutex);
+	#endif
+}
+
+void unlockMutex(Mutex* mutex)
+{
+	#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+	#else
+	pthread_mutex_unlock(mutex);
+	#endif
+}
+
+void initCondVar(CondVar* condVar)
+{
+	#ifdef _WIN32
+
+	InitializeConditionVariable(condVar);
+
+	#else
+
+	// monotonic clock, so timeouts are not affected by system time changes
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(condVar, &attr);
+	pthread_condattr_destroy(&attr);
+
+	#endif
+}
+
+void waitCondVar(CondVar* condVar, Mutex* mutex)
+{
+	#ifdef _WIN32
+	SleepConditionVariableCS(condVar, mutex, INFINITE);
+	#else
+	pthread_cond_wait(condVar, mutex);
+	#endif
+}
+
+bool waitCondVarTimeout(CondVar* condVar, Mutex* mutex, DWORD ms)
+{
+	#ifdef _WIN32
+
+	return SleepConditionVariableCS(condVar, mutex, ms) != 0;
+
+	#else
+
+	struct timespec timeSpec;
+	clock_gettime(CLOCK_MONOTONIC, &timeSpec);
+	timeSpec.tv_sec += ms / 1000;
+	timeSpec.tv_nsec += (ms % 1000) * 1000000;
+	if (timeSpec.tv_nsec >= 1000000000)
+	{
+		timeSpec.tv_sec++;
+		timeSpec.tv_nsec -= 1000000000;
+	}
+	return pthread_cond_timedwait(condVar, mutex, &timeSpec) == 0;
+
+	#endif
+}
+
+void wakeCondVar(CondVar* condVar)
+{
+	#ifdef _WIN32
+	WakeAllConditionVariable(condVar);
+	#else
+	pthread_cond_broadcast(condVar);
+	#endif
+}
+
 void strToLower(char* str)
 {
 	for (int i = 0; i < strlen(str); i++)
@@ -190,6 +372,8 @@ void enableANSI(void)
 
 size_t getOutputArraySize(int w, int h)
 {
+	// maximum size of one cell, shorter codes (without leading zeros) are written into it,
+	// but processImage() copies fixed-size code table entries which can take up whole cell
 	const int CSTD_16_CODE_LEN = 6;   // "\x1B[??m?"
 	const int CSTD_256_CODE_LEN = 12; // "\x1B[38;5;???m?"
 	const int CSTD_RGB_CODE_LEN = 20; // "\x1B[38;2;???;???;???m?"
@@ -225,6 +409,7 @@ void cpExit(int code)
 	#endif
 
 	setDefaultColor();
+	if (settings.printStats) { printStats(); }
 	exit((int)code);
 }
 
@@ -0,0 +1,48 @@
+// findNearestColor16() and rgbToAnsi256() as they were before lookup tables (processFrame.c),
+// used as reference by colorTablesTest.c and colorTablesBench.c, which include processFrame.c
+// before this header to get its static functions and CMD_COLORS_16 palette.
+
+#ifndef CP_COLOR_REFERENCE_H
+#define CP_COLOR_REFERENCE_H
+
+// processFrame.c uses band helper threads from threads.c, tests run all bands on the calling thread
+void runBands(BandFuncPtr bandFunc, void* args, int bandCount)
+{
+	for (int i = 0; i < bandCount; i++) { bandFunc(args, i); }
+}
+
+static uint8_t refFindNearestColor16(uint8_t r, uint8_t g, uint8_t b)
+{
+	int min = INT_MAX;
+	int minPos = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int diff = (r - CMD_COLORS_16[i][0]) * (r - CMD_COLORS_16[i][0]) +
+			(g - CMD_COLORS_16[i][1]) * (g - CMD_COLORS_16[i][1]) +
+			(b - CMD_COLORS_16[i][2]) * (b - CMD_COLORS_16[i][2]);
+		if (diff < min)
+		{
+			min = diff;
+			minPos = i;
+		}
+	}
+	return (uint8_t)minPos;
+}
+
+static uint8_t refRgbToAnsi256(uint8_t r, uint8_t g, uint8_t b)
+{
+	// https://stackoverflow.com/a/26665998
+	if (r == g && g == b)
+	{
+		if (r < 8) { return 16; }
+		if (r > 248) { return 231; }
+		return (uint8_t)round((((double)r - 8.0) / 247.0) * 24.0) + 232;
+	}
+
+	return (uint8_t)(16.0
+		+ (36.0 * round((double)r / 51.0))  // 51 = 255/5
+		+ (6.0 * round((double)g / 51.0))
+		+ round((double)b / 51.0));
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+// Microbenchmark of table based findNearestColor16() and rgbToAnsi256() (processFrame.c) compared
+// with the reference implementation. Random pixels are the worst case for findNearestColor16(),
+// because they often fall into cube cells where more than one palette color can be the nearest,
+// gradient is closer to real video. Build with "make conpl_color_tables_bench".
+
+#include "../src/processFrame.c"
+#include "colorReference.h"
+
+HWND conHWND = NULL, wtDragBarHWND = NULL;
+int conW = -1, conH = -1;
+int vidW = -1, vidH = -1;
+double fps = 0.0;
+bool ansiEnabled = false;
+bool decodeEnd = false;
+Settings settings;
+
+typedef uint8_t(*ColorFuncPtr)(uint8_t r, uint8_t g, uint8_t b);
+
+static const int PIXEL_COUNT = 1 << 20;
+static const int64_t MIN_BENCH_TIME = 500000000; // ns per measured function
+
+static volatile uint8_t sink;
+
+static double benchColorFunc(ColorFuncPtr func, const uint8_t* pixels);
+static void printRow(const char* name, ColorFuncPtr tableFunc, ColorFuncPtr refFunc, const uint8_t* pixels);
+
+int main(void)
+{
+	int64_t initStart = getTimeNs();
+	initColorTables();
+	printf("Tables built in %.2f ms\n", (double)(getTimeNs() - initStart) / 1000000.0);
+
+	uint8_t* random = (uint8_t*)malloc(PIXEL_COUNT * 3);
+	uint8_t* gradient = (uint8_t*)malloc(PIXEL_COUNT * 3);
+	if (!random || !gradient) { error("Failed to allocate memory!", "colorTablesBench.c", __LINE__); }
+
+	uint32_t randState = 1;
+	for (int i = 0; i < PIXEL_COUNT * 3; i++) { random[i] = (uint8_t)cpRand(&randState); }
+	for (int i = 0; i < PIXEL_COUNT; i++)
+	{
+		gradient[i * 3] = (uint8_t)(i >> 12);
+		gradient[i * 3 + 1] = (uint8_t)(i >> 4);
+		gradient[i * 3 + 2] = (uint8_t)((i >> 12) + (i >> 4));
+	}
+
+	printf("%-28s %6s  %6s\n", "ns per pixel", "table", "reference");
+	printRow("findNearestColor16  random", findNearestColor16, refFindNearestColor16, random);
+	printRow("findNearestColor16  gradient", findNearestColor16, refFindNearestColor16, gradient);
+	printRow("rgbToAnsi256        random", rgbToAnsi256, refRgbToAnsi256, random);
+	printRow("rgbToAnsi256        gradient", rgbToAnsi256, refRgbToAnsi256, gradient);
+
+	free(random);
+	free(gradient);
+	return 0;
+}
+
+static double benchColorFunc(ColorFuncPtr func, const uint8_t* pixels)
+{
+	int64_t passes = 0;
+	int64_t start = getTimeNs();
+	do
+	{
+		uint8_t acc = 0;
+		for (int i = 0; i < PIXEL_COUNT; i++) { acc ^= func(pixels[i * 3], pixels[i * 3 + 1], pixels[i * 3 + 2]); }
+		sink = acc;
+		passes++;
+	} while (getTimeNs() - start < MIN_BENCH_TIME);
+
+	return (double)(getTimeNs() - start) / (double)(passes * PIXEL_COUNT);
+}
+
+static void printRow(const char* name, ColorFuncPtr tableFunc, ColorFuncPtr refFunc, const uint8_t* pixels)
+{
+	double tableTime = benchColorFunc(tableFunc, pixels);
+	double refTime = benchColorFunc(refFunc, pixels);
+	printf("%-28s %6.2f  %6.2f (%.1fx)\n", name, tableTime, refTime, refTime / tableTime);
+}
\ No newline at end of file
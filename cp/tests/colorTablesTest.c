@@ -0,0 +1,55 @@
+// Exhaustive check of table based findNearestColor16() and rgbToAnsi256() (processFrame.c) -
+// both have to return the same value as the reference implementation for all 2^24 colors.
+// Build with "make conpl_color_tables_test".
+
+#include "../src/processFrame.c"
+#include "colorReference.h"
+
+HWND conHWND = NULL, wtDragBarHWND = NULL;
+int conW = -1, conH = -1;
+int vidW = -1, vidH = -1;
+double fps = 0.0;
+bool ansiEnabled = false;
+bool decodeEnd = false;
+Settings settings;
+
+int main(void)
+{
+	initColorTables();
+
+	int64_t nearestErrors = 0, ansiErrors = 0;
+	for (int r = 0; r < 256; r++)
+	{
+		for (int g = 0; g < 256; g++)
+		{
+			for (int b = 0; b < 256; b++)
+			{
+				uint8_t nearest = findNearestColor16((uint8_t)r, (uint8_t)g, (uint8_t)b);
+				uint8_t ansi = rgbToAnsi256((uint8_t)r, (uint8_t)g, (uint8_t)b);
+
+				if (nearest != refFindNearestColor16((uint8_t)r, (uint8_t)g, (uint8_t)b))
+				{
+					if (!nearestErrors) { printf("findNearestColor16(%d, %d, %d) = %d\n", r, g, b, nearest); }
+					nearestErrors++;
+				}
+				if (ansi != refRgbToAnsi256((uint8_t)r, (uint8_t)g, (uint8_t)b))
+				{
+					if (!ansiErrors) { printf("rgbToAnsi256(%d, %d, %d) = %d\n", r, g, b, ansi); }
+					ansiErrors++;
+				}
+			}
+		}
+	}
+
+	printf("findNearestColor16: %" PRId64 " different colors\n", nearestErrors);
+	printf("rgbToAnsi256: %" PRId64 " different colors\n", ansiErrors);
+
+	if (nearestErrors || ansiErrors)
+	{
+		puts("FAILED");
+		return 1;
+	}
+
+	puts("OK");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+// Stress test of frame queue (queue.c) - main thread loads frames, several processing threads
+// process them out of order and drawing thread checks that every frame arrives in order with
+// everything written by previous stages. In the second half drawing is slowed down, so queue
+// shrinks and slots have to give their buffers back without reallocating them for every frame.
+// Build with "make conpl_queue_test", or "make conpl_queue_test_tsan" to check it with ThreadSanitizer
+// (threads aren't joined, so run it with TSAN_OPTIONS=report_thread_leaks=0).
+
+#include "../src/conplayer.h"
+
+HWND conHWND = NULL, wtDragBarHWND = NULL;
+int conW = -1, conH = -1;
+int vidW = -1, vidH = -1;
+double fps = 0.0;
+bool ansiEnabled = false;
+bool decodeEnd = false;
+Settings settings;
+psnip_atomic_int32 seekGeneration = 0;
+
+static const int FRAME_COUNT = 200000;
+static const int PROC_THREADS = 4;
+static const int SLOW_DRAW_US = 20;
+static const size_t BUFFER_SIZE = 64;
+
+static volatile int bufferAllocations = 0;
+
+static ThreadRetType CP_CALL_CONV loadThread(void* ptr);
+static ThreadRetType CP_CALL_CONV procThread(void* ptr);
+static uint32_t frameHash(int64_t sequence);
+static void fail(const char* description, int64_t sequence);
+
+int main(void)
+{
+	settings.queueMinDepth = 4;
+	settings.queueMaxDepth = 16;
+	settings.queueMem = 0;
+
+	initBufferPool();
+	initQueue();
+
+	startThread(&loadThread, NULL);
+	for (int i = 0; i < PROC_THREADS; i++) { startThread(&procThread, NULL); }
+
+	for (int64_t i = 0; i < FRAME_COUNT; i++)
+	{
+		Frame* frame = dequeueFrame(STAGE_PROCESSED_FRAME);
+
+		if (frame->time != i) { fail("Frame drawn out of order", i); }
+		if (frame->w != (int)frameHash(i) || frame->h != (int)~frameHash(i) ||
+			((uint32_t*)frame->output)[0] != frameHash(i))
+		{
+			fail("Frame drawn before it was processed", i);
+		}
+
+		frame->time = -1;
+		if (i >= FRAME_COUNT / 2) { sleepUntilNs(getTimeNs() + (SLOW_DRAW_US * 1000)); }
+		enqueueFrame(frame, STAGE_FREE);
+	}
+
+	printf("%d frames drawn in order\n", FRAME_COUNT);
+	printf("depth: %d (%d - %d), underruns: %d\n", stats.queueDepth,
+		stats.queueMinDepthSeen, stats.queueMaxDepthSeen, stats.queueUnderruns);
+	printf("slot buffer allocations: %d\n", bufferAllocations);
+
+	// every shrink and grow of the queue can reallocate one slot, but not every frame
+	if (bufferAllocations > FRAME_COUNT / 100) { fail("Slot buffers are reallocated too often", FRAME_COUNT); }
+
+	puts("OK");
+	return 0;
+}
+
+static ThreadRetType CP_CALL_CONV loadThread(void* ptr)
+{
+	for (int64_t i = 0; i < FRAME_COUNT; i++)
+	{
+		Frame* frame = dequeueFrame(STAGE_FREE);
+
+		if (!frame->output)
+		{
+			frame->output = poolAlloc(BUFFER_SIZE);
+			bufferAllocations++;
+		}
+
+		frame->time = i;
+		frame->w = (int)frameHash(i);
+		frame->h = 0;
+		enqueueFrame(frame, STAGE_LOADED_FRAME);
+	}
+
+	CP_END_THREAD
+}
+
+static ThreadRetType CP_CALL_CONV procThread(void* ptr)
+{
+	while (true)
+	{
+		Frame* frame = dequeueFrame(STAGE_LOADED_FRAME);
+
+		if (frame->w != (int)frameHash(frame->time)) { fail("Frame processed before it was loaded", frame->time); }
+
+		// uneven processing time lets later frames overtake earlier ones
+		if (frame->time % 7 == 0) { sleepUntilNs(getTimeNs() + 1000); }
+
+		frame->h = (int)~frameHash(frame->time);
+		((uint32_t*)frame->output)[0] = frameHash(frame->time);
+		enqueueFrame(frame, STAGE_PROCESSED_FRAME);
+	}
+
+	CP_END_THREAD
+}
+
+static uint32_t frameHash(int64_t sequence)
+{
+	uint32_t state = ((uint32_t)sequence * 2) + 1;
+	return cpRand(&state);
+}
+
+static void fail(const char* description, int64_t sequence)
+{
+	printf("FAILED: %s (frame %" PRId64 ")\n", description, sequence);
+	exit(1);
+}
\ No newline at end of file
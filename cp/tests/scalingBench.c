@@ -0,0 +1,177 @@
+// Benchmark of scaling into the console grid in gray color modes - area scaling straight from
+// luma plane (scaling.c, default "auto" scaling mode) compared with swscale to GRAY8 using bicubic
+// (default before direct scaling) and area filters. Output of direct scaling is also checked
+// against naive area average of the same pixels, the program fails if they differ.
+// Build with "make conpl_scaling_bench".
+
+#include "../src/conplayer.h"
+
+HWND conHWND = NULL, wtDragBarHWND = NULL;
+int conW = -1, conH = -1;
+int vidW = -1, vidH = -1;
+double fps = 0.0;
+bool ansiEnabled = false;
+bool decodeEnd = false;
+Settings settings;
+
+typedef struct
+{
+	int w, h;
+} Size;
+
+static const int SRC_W = 1920;
+static const int SRC_H = 1080;
+static const Size DST_SIZES[] = { { 80, 24 }, { 160, 45 }, { 240, 67 }, { 480, 135 } };
+static const int DST_SIZE_COUNT = sizeof(DST_SIZES) / sizeof(Size);
+static const int64_t MIN_BENCH_TIME = 500000000; // ns per measured function
+
+static AVFrame* createSourceFrame(void);
+static double benchDirect(AVFrame* frame, uint8_t* dst, int dstW, int dstH);
+static double benchSws(AVFrame* frame, uint8_t* dst, int dstW, int dstH, int flags, double* initTime);
+static int naiveAreaDiff(AVFrame* frame, const uint8_t* dst, int dstW, int dstH);
+static int maxDiff(const uint8_t* a, const uint8_t* b, int size);
+
+int main(void)
+{
+	AVFrame* frame = createSourceFrame();
+	bool failed = false;
+
+	printf("Source: %dx%d yuv420p, limited range\n", SRC_W, SRC_H);
+	puts("Time in ms per frame: direct - area scaling from luma plane, bicubic/area - swscale\n"
+		"(init - creating context). Maximum difference of direct output from naive area average\n"
+		"and from swscale area.\n");
+	printf(" %-7s  %7s  %7s  %7s  %7s  %7s  %5s  %5s\n", "size", "direct", "bicubic", "init", "area", "init", "naive", "area");
+
+	for (int i = 0; i < DST_SIZE_COUNT; i++)
+	{
+		int dstW = DST_SIZES[i].w, dstH = DST_SIZES[i].h;
+		uint8_t* direct = (uint8_t*)malloc(dstW * dstH);
+		uint8_t* sws = (uint8_t*)malloc(dstW * dstH);
+		if (!direct || !sws) { error("Failed to allocate memory!", "scalingBench.c", __LINE__); }
+
+		double bicubicInit, areaInit;
+		double directTime = benchDirect(frame, direct, dstW, dstH);
+		double bicubicTime = benchSws(frame, sws, dstW, dstH, SWS_BICUBIC, &bicubicInit);
+		double areaTime = benchSws(frame, sws, dstW, dstH, SWS_AREA, &areaInit);
+
+		int naiveDiff = naiveAreaDiff(frame, direct, dstW, dstH);
+		if (naiveDiff) { failed = true; }
+
+		printf(" %3dx%-3d  %7.3f  %7.3f  %7.3f  %7.3f  %7.3f  %5d  %5d\n", dstW, dstH,
+			directTime, bicubicTime, bicubicInit, areaTime, areaInit,
+			naiveDiff, maxDiff(direct, sws, dstW * dstH));
+
+		free(direct);
+		free(sws);
+	}
+
+	av_frame_free(&frame);
+
+	if (failed)
+	{
+		puts("FAILED: direct scaling differs from naive area average");
+		return 1;
+	}
+	return 0;
+}
+
+static AVFrame* createSourceFrame(void)
+{
+	AVFrame* frame = av_frame_alloc();
+	if (!frame) { error("Failed to allocate frame!", "scalingBench.c", __LINE__); }
+
+	frame->width = SRC_W;
+	frame->height = SRC_H;
+	frame->format = AV_PIX_FMT_YUV420P;
+	frame->color_range = AVCOL_RANGE_MPEG;
+	if (av_frame_get_buffer(frame, 0) < 0) { error("Failed to allocate frame buffer!", "scalingBench.c", __LINE__); }
+
+	// gradient with noise, so neither swscale nor direct scaling can take shortcuts
+	uint32_t randState = 1;
+	for (int y = 0; y < SRC_H; y++)
+	{
+		for (int x = 0; x < SRC_W; x++)
+		{
+			frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(16 + ((x + y) * 219) / (SRC_W + SRC_H) + (cpRand(&randState) & 15));
+		}
+	}
+	for (int p = 1; p < 3; p++)
+	{
+		for (int y = 0; y < SRC_H / 2; y++) { memset(frame->data[p] + y * frame->linesize[p], 128, SRC_W / 2); }
+	}
+
+	return frame;
+}
+
+static double benchDirect(AVFrame* frame, uint8_t* dst, int dstW, int dstH)
+{
+	// first call computes cell bounds for the size, like the first frame after console resize
+	scaleLuma(frame, dst, dstW, dstW, dstH);
+
+	int iterations = 0;
+	int64_t start = getTimeNs();
+	do
+	{
+		scaleLuma(frame, dst, dstW, dstW, dstH);
+		iterations++;
+	} while (getTimeNs() - start < MIN_BENCH_TIME);
+
+	return (double)(getTimeNs() - start) / (iterations * 1000000.0);
+}
+
+static double benchSws(AVFrame* frame, uint8_t* dst, int dstW, int dstH, int flags, double* initTime)
+{
+	int64_t initStart = getTimeNs();
+	struct SwsContext* context = sws_getContext(SRC_W, SRC_H, AV_PIX_FMT_YUV420P,
+		dstW, dstH, AV_PIX_FMT_GRAY8, flags, NULL, NULL, NULL);
+	if (!context) { error("Failed to create scaling context!", "scalingBench.c", __LINE__); }
+	*initTime = (double)(getTimeNs() - initStart) / 1000000.0;
+
+	uint8_t* dstData[4] = { dst, NULL, NULL, NULL };
+	int dstLinesize[4] = { dstW, 0, 0, 0 };
+
+	int iterations = 0;
+	int64_t start = getTimeNs();
+	do
+	{
+		sws_scale(context, (const uint8_t* const*)frame->data, frame->linesize, 0, SRC_H, dstData, dstLinesize);
+		iterations++;
+	} while (getTimeNs() - start < MIN_BENCH_TIME);
+
+	double time = (double)(getTimeNs() - start) / (iterations * 1000000.0);
+	sws_freeContext(context);
+	return time;
+}
+
+static int naiveAreaDiff(AVFrame* frame, const uint8_t* dst, int dstW, int dstH)
+{
+	int diff = 0;
+	for (int y = 0; y < dstH; y++)
+	{
+		int rowStart = (y * SRC_H) / dstH, rowEnd = ((y + 1) * SRC_H) / dstH;
+		for (int x = 0; x < dstW; x++)
+		{
+			int columnStart = (x * SRC_W) / dstW, columnEnd = ((x + 1) * SRC_W) / dstW;
+			uint32_t sum = 0;
+			uint32_t area = (uint32_t)((rowEnd - rowStart) * (columnEnd - columnStart));
+
+			for (int i = rowStart; i < rowEnd; i++)
+			{
+				for (int j = columnStart; j < columnEnd; j++) { sum += frame->data[0][i * frame->linesize[0] + j]; }
+			}
+
+			// limited range is expanded to full range, as swscale does for GRAY8
+			int val = (int)((sum + area / 2) / area);
+			val = cp_clamp(((val - 16) * 255 + 109) / 219, 0, 255);
+			diff = cp_max(diff, abs(val - dst[y * dstW + x]));
+		}
+	}
+	return diff;
+}
+
+static int maxDiff(const uint8_t* a, const uint8_t* b, int size)
+{
+	int diff = 0;
+	for (int i = 0; i < size; i++) { diff = cp_max(diff, abs(a[i] - b[i])); }
+	return diff;
+}
\ No newline at end of file